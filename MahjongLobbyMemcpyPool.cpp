@@ -1,5 +1,6 @@
 #include "MahjongLobbyMemcpyPool.h"
 #include "common/majhongmemorypool.h"
+#include "common/majhongbufferchain.h"
 
 using namespace std;
 using namespace MahjongMemoryPool;
@@ -9,7 +10,7 @@ void UnitTestBasicAllocation()
 {
 	cout << " 开始执行单元测试   BasicAllocationBasicAllocation start" << endl;
     // 测试小内存分配
-    void* ptr1 = MahjongMemoryPool::NewMemoryCache(8);
+    void* ptr1 = MemoryPool::NewMemoryCache(8);
     assert(ptr1 != nullptr);
     MemoryPool::DeleteMemoryCache(ptr1, 8);
 
@@ -45,7 +46,7 @@ void UnitTestMomoryWrite()
         assert(pstTemp[i] == static_cast<char>(i % 256));
     }
 
-    MemoryPool::deallocate(ptr, size);
+    MemoryPool::DeleteMemoryCache(pstTemp, nSize);
 
     cout << " 开始执行单元测试   UnitTestMomoryWrite end" << endl;
 }
@@ -69,7 +70,7 @@ void UnitTestMultiThreading()
             {
                 size_t nSize = (rand() % 256 + 1) * 8;
                 void* pTemp = MemoryPool::NewMemoryCache(nSize);
-                if (nullptr = pTemp)
+                if (nullptr == pTemp)
                 {
                     std::cerr << "UnitTestMultiThreading NewMemoryCache Fail   nSize = " << nSize << std::endl;
                     HasError = true;
@@ -112,6 +113,629 @@ void UnitTestMultiThreading()
     std::cout << "开始执行单元测试 UnitTestMultiThreading end" << std::endl;
 }
 
+// 原地调整大小测试
+void UnitTestResize()
+{
+    std::cout << "开始执行单元测试 UnitTestResize start" << std::endl;
+    // 同一尺寸类内调整返回原指针
+    char* pstSmall = static_cast<char*>(MemoryPool::NewMemoryCache(20));
+    assert(pstSmall != nullptr);
+    assert(MemoryPool::GetUsableSize(pstSmall) == 24);
+    memset(pstSmall, 0x5a, 20);
+    assert(MemoryPool::ResizeMemoryCache(pstSmall, 20, 24) == pstSmall);
+
+    // 跨尺寸类调整搬移数据
+    char* pstMoved = static_cast<char*>(MemoryPool::ResizeMemoryCache(pstSmall, 24, 200));
+    assert(pstMoved != nullptr);
+    assert(MemoryPool::GetUsableSize(pstMoved) == 200);
+    for (size_t i = 0; i < 20; ++i)
+    {
+        assert(pstMoved[i] == 0x5a);
+    }
+    MemoryPool::DeleteMemoryCache(pstMoved, 200);
+
+    // 大对象：从刚释放的大span头部切出，再原地扩展进尾部的空闲页
+    const size_t nLargeSize = 64 * 4096;
+    char* pstBlock = static_cast<char*>(MemoryPool::NewMemoryCache(MAX_BYTES + nLargeSize * 2));
+    assert(pstBlock != nullptr);
+    MemoryPool::DeleteMemoryCache(pstBlock, MAX_BYTES + nLargeSize * 2);
+
+    char* pstLarge = static_cast<char*>(MemoryPool::NewMemoryCache(MAX_BYTES + 1));
+    assert(pstLarge != nullptr);
+    assert(MemoryPool::GetUsableSize(pstLarge) == MAX_BYTES + 4096);
+    pstLarge[0] = 'M';
+    if (pstLarge == pstBlock)
+    {
+        assert(MemoryPool::ResizeMemoryCache(pstLarge, MAX_BYTES + 1, MAX_BYTES + nLargeSize) == pstLarge);
+        assert(MemoryPool::GetUsableSize(pstLarge) == MAX_BYTES + nLargeSize);
+    }
+
+    // 缩小始终原地完成
+    assert(MemoryPool::ResizeMemoryCache(pstLarge, MAX_BYTES + nLargeSize, MAX_BYTES + 1) == pstLarge);
+    assert(pstLarge[0] == 'M');
+    MemoryPool::DeleteMemoryCache(pstLarge, MAX_BYTES + 1);
+    std::cout << "结束执行单元测试 UnitTestResize end" << std::endl;
+}
+
+// 独立堆测试
+void UnitTestHeap()
+{
+    std::cout << "开始执行单元测试 UnitTestHeap start" << std::endl;
+    MahjongHeapConfig stConfig;
+    stConfig.m_nSpanPageNum = 16;
+    MahjongHeap stChatHeap(stConfig);
+    MahjongHeap stReplayHeap;
+
+    // 两个堆的内存互不混用，各自统计
+    void* pstChat = stChatHeap.NewMemoryCache(64);
+    void* pstReplay = stReplayHeap.NewMemoryCache(MAX_BYTES * 2);
+    assert(pstChat != nullptr && pstReplay != nullptr);
+    assert(stChatHeap.GetUsableSize(pstChat) == 64);
+    assert(stReplayHeap.GetUsableSize(pstChat) == 0);
+    // 首次补充时页暂存区一次取m_nPageStashNum个span
+    assert(stChatHeap.GetSystemCacheSize() == 16 * MahjongPageCache::PAGESIZE * stConfig.m_nPageStashNum);
+    assert(stReplayHeap.GetSystemCacheSize() >= MAX_BYTES * 2);
+
+    // 其他线程在堆上分配后退出，线程缓存归还堆
+    std::vector<std::thread> vecThread;
+    for (int i = 0; i < 4; ++i)
+    {
+        vecThread.emplace_back([&stChatHeap]()
+        {
+            for (size_t nSize = 8; nSize <= 4096; nSize += 8)
+            {
+                void* pTemp = stChatHeap.NewMemoryCache(nSize);
+                assert(pTemp != nullptr);
+                stChatHeap.DeleteMemoryCache(pTemp, nSize);
+            }
+        });
+    }
+    for (auto& thread : vecThread)
+    {
+        thread.join();
+    }
+
+    // 整体释放后统计清零，堆可以继续使用
+    stChatHeap.Destroy();
+    assert(stChatHeap.GetSystemCacheSize() == 0);
+    pstChat = stChatHeap.NewMemoryCache(64);
+    assert(pstChat != nullptr);
+    stChatHeap.DeleteMemoryCache(pstChat, 64);
+
+    // 反复创建销毁的堆不会在线程缓存表中留下表项
+    size_t nTableSize = MahjongHeap::GetThreadCacheTableSize();
+    for (int i = 0; i < 100; ++i)
+    {
+        MahjongHeap stRoomHeap;
+        stRoomHeap.DeleteMemoryCache(stRoomHeap.NewMemoryCache(64), 64);
+    }
+    assert(MahjongHeap::GetThreadCacheTableSize() <= nTableSize + 1);
+
+    // 大对象并发分配释放的同时不断归还系统，各分片的区域记录不能互相误删
+    {
+        MahjongHeap stRoomHeap;
+        std::atomic<bool> bStop{ false };
+        std::thread stReleaseThread([&stRoomHeap, &bStop]()
+        {
+            while (!bStop.load(std::memory_order_relaxed))
+            {
+                stRoomHeap.ReleaseFreeMemory();
+            }
+        });
+
+        vecThread.clear();
+        for (size_t i = 0; i < 4; ++i)
+        {
+            vecThread.emplace_back([&stRoomHeap, i]()
+            {
+                for (size_t j = 0; j < 1000; ++j)
+                {
+                    size_t nSize = MAX_BYTES + 1 + (i + j) % 16 * MahjongPageCache::PAGESIZE;
+                    void* pTemp = stRoomHeap.NewMemoryCache(nSize);
+                    assert(stRoomHeap.GetUsableSize(pTemp) >= nSize);
+                    stRoomHeap.DeleteMemoryCache(pTemp, nSize);
+                }
+            });
+        }
+        for (auto& thread : vecThread)
+        {
+            thread.join();
+        }
+        bStop.store(true, std::memory_order_relaxed);
+        stReleaseThread.join();
+
+        stRoomHeap.ReleaseFreeMemory();
+        assert(stRoomHeap.GetReport().m_nLargeSpanSize == 0);
+    }
+
+    stReplayHeap.DeleteMemoryCache(pstReplay, MAX_BYTES * 2);
+    std::cout << "结束执行单元测试 UnitTestHeap end" << std::endl;
+}
+
+// 画像预热测试
+void UnitTestPrewarm()
+{
+    std::cout << "开始执行单元测试 UnitTestPrewarm start" << std::endl;
+    const std::string strPath = "/tmp/mahjong_heap_profile.txt";
+    const size_t arrSize[] = { 48, 1024, 40000 };
+    const size_t nBlockNum = 300;
+
+    // 模拟一段线上流量并保存画像
+    {
+        MahjongHeap stHeap;
+        std::vector<void*> vecCache;
+        for (size_t nSize : arrSize)
+        {
+            for (size_t i = 0; i < nBlockNum; ++i)
+            {
+                vecCache.push_back(stHeap.NewMemoryCache(nSize));
+            }
+        }
+        for (size_t i = 0; i < vecCache.size(); ++i)
+        {
+            stHeap.DeleteMemoryCache(vecCache[i], arrSize[i / nBlockNum]);
+        }
+        assert(stHeap.SaveProfile(strPath));
+    }
+
+    MahjongHeapProfile vecProfile;
+    assert(MahjongHeap::LoadProfile(strPath, vecProfile));
+    assert(vecProfile.size() == 3);
+
+    // 新进程启动时后台预热，之后同样的流量不再向系统申请内存
+    MahjongHeap stHeap;
+    assert(stHeap.PrewarmByProfile(strPath, true));
+    stHeap.WaitPrewarm();
+    size_t nSystemCacheSize = stHeap.GetSystemCacheSize();
+    assert(nSystemCacheSize > 0);
+
+    std::vector<void*> vecCache;
+    for (size_t nSize : arrSize)
+    {
+        for (size_t i = 0; i < nBlockNum; ++i)
+        {
+            vecCache.push_back(stHeap.NewMemoryCache(nSize));
+        }
+    }
+    assert(stHeap.GetSystemCacheSize() == nSystemCacheSize);
+    for (size_t i = 0; i < vecCache.size(); ++i)
+    {
+        stHeap.DeleteMemoryCache(vecCache[i], arrSize[i / nBlockNum]);
+    }
+
+    // 块数异常的画像在读取时丢弃；直接传入时预热量不超过硬上限
+    {
+        std::ofstream stFile(strPath, std::ios::trunc);
+        stFile << "8 18446744073709551615\n";
+    }
+    assert(!MahjongHeap::LoadProfile(strPath, vecProfile));
+    MahjongHeapConfig stLimitConfig;
+    stLimitConfig.m_nHardLimit = 1024 * 1024;
+    MahjongHeap stLimitHeap(stLimitConfig);
+    stLimitHeap.Prewarm({ { 8, SIZE_MAX }, { 1024, SIZE_MAX } });
+    assert(stLimitHeap.GetSystemCacheSize() > 0 && stLimitHeap.GetSystemCacheSize() <= stLimitConfig.m_nHardLimit);
+    std::remove(strPath.c_str());
+    std::cout << "结束执行单元测试 UnitTestPrewarm end" << std::endl;
+}
+
+// 缓冲链测试
+void UnitTestBufferChain()
+{
+    std::cout << "开始执行单元测试 UnitTestBufferChain start" << std::endl;
+    int arrFd[2];
+    int nRet = socketpair(AF_UNIX, SOCK_STREAM, 0, arrFd);
+    assert(nRet == 0);
+
+    // 5000字节的包体跨越多个段
+    std::vector<char> vecPayload(5000);
+    for (size_t i = 0; i < vecPayload.size(); ++i)
+    {
+        vecPayload[i] = static_cast<char>(i % 251);
+    }
+    MahjongBufferChain stPayload;
+    stPayload.Append(vecPayload.data(), vecPayload.size());
+    assert(stPayload.GetSize() == vecPayload.size());
+
+    // 广播给两个会话：共享包体，只各自加协议头
+    iovec arrPayloadIovec[8];
+    size_t nPayloadIovecNum = stPayload.GetReadIovec(arrPayloadIovec, 8);
+    std::vector<MahjongBufferChain> vecSession(2, stPayload);
+    for (size_t i = 0; i < vecSession.size(); ++i)
+    {
+        uint32_t nHeader = static_cast<uint32_t>(i + 1);
+        vecSession[i].Prepend(&nHeader, sizeof(nHeader));
+
+        iovec arrIovec[8];
+        size_t nIovecNum = vecSession[i].GetReadIovec(arrIovec, 8);
+        assert(nIovecNum == nPayloadIovecNum + 1);
+        assert(arrIovec[1].iov_base == arrPayloadIovec[0].iov_base);
+    }
+
+    // 通过socketpair发送并用readv接收
+    for (size_t i = 0; i < vecSession.size(); ++i)
+    {
+        while (!vecSession[i].IsEmpty())
+        {
+            assert(vecSession[i].WriteToFd(arrFd[0]) > 0);
+        }
+    }
+
+    MahjongBufferChain stRecv;
+    size_t nExpectSize = (sizeof(uint32_t) + vecPayload.size()) * vecSession.size();
+    while (stRecv.GetSize() < nExpectSize)
+    {
+        assert(stRecv.ReadFromFd(arrFd[1], 4096) > 0);
+    }
+
+    for (size_t i = 0; i < vecSession.size(); ++i)
+    {
+        uint32_t nHeader = 0;
+        assert(stRecv.CopyTo(&nHeader, sizeof(nHeader)) == sizeof(nHeader));
+        assert(nHeader == i + 1);
+        stRecv.Consume(sizeof(nHeader));
+
+        // 切片与原链共享段，内容与发送一致
+        MahjongBufferChain stBody = stRecv.Slice(0, vecPayload.size());
+        std::vector<char> vecBody(vecPayload.size());
+        assert(stBody.CopyTo(vecBody.data(), vecBody.size()) == vecBody.size());
+        assert(vecBody == vecPayload);
+        stRecv.Consume(vecPayload.size());
+    }
+    assert(stRecv.IsEmpty());
+
+    close(arrFd[0]);
+    close(arrFd[1]);
+    std::cout << "结束执行单元测试 UnitTestBufferChain end" << std::endl;
+}
+
+// 持久化堆测试：析构堆只断开映射，同名段重新挂载后找回根对象
+void UnitTestPersistentHeap()
+{
+    std::cout << "开始执行单元测试 UnitTestPersistentHeap start" << std::endl;
+    struct RoomState
+    {
+        int32_t m_nRoomId;
+        char* m_pstReplay;
+    };
+
+    MahjongHeapConfig stConfig;
+    stConfig.m_strPersistentName = "/mahjong_unit_test_heap";
+    stConfig.m_nPersistentAddr = 0x500000000000ULL;
+    stConfig.m_nPersistentSize = 64 * 1024 * 1024;
+    MahjongPersistentSegment::Remove(stConfig.m_strPersistentName);
+
+    const size_t nReplaySize = MAX_BYTES * 2;
+    {
+        MahjongHeap stHeap(stConfig);
+        assert(stHeap.IsPersistent() && !stHeap.IsRecovered());
+
+        RoomState* pstRoom = static_cast<RoomState*>(stHeap.NewMemoryCache(sizeof(RoomState)));
+        pstRoom->m_nRoomId = 8001;
+        pstRoom->m_pstReplay = static_cast<char*>(stHeap.NewMemoryCache(nReplaySize));
+        memset(pstRoom->m_pstReplay, 'R', nReplaySize);
+        assert(stHeap.SetRoot("room", pstRoom));
+
+        // 段已被挂载时不能再次挂载（如滚动重启时旧进程尚未退出）
+        MahjongPersistentSegment stSegment;
+        assert(!stSegment.Open(stConfig.m_strPersistentName, stConfig.m_nPersistentAddr + stConfig.m_nPersistentSize,
+            stConfig.m_nPersistentSize));
+    }
+
+    {
+        // 模拟进程重启
+        MahjongHeap stHeap(stConfig);
+        assert(stHeap.IsPersistent() && stHeap.IsRecovered());
+
+        RoomState* pstRoom = static_cast<RoomState*>(stHeap.GetRoot("room"));
+        assert(pstRoom != nullptr && pstRoom->m_nRoomId == 8001);
+        assert(pstRoom->m_pstReplay[0] == 'R' && pstRoom->m_pstReplay[nReplaySize - 1] == 'R');
+        assert(stHeap.GetUsableSize(pstRoom->m_pstReplay) == nReplaySize);
+        assert(stHeap.GetUsableSize(pstRoom) == MahJongSizeClass::RoundUp(sizeof(RoomState)));
+
+        // 恢复后的大对象可以正常释放和复用
+        stHeap.DeleteMemoryCache(pstRoom->m_pstReplay, nReplaySize);
+        void* pstReuse = stHeap.NewMemoryCache(nReplaySize);
+        assert(pstReuse == pstRoom->m_pstReplay);
+        stHeap.DeleteMemoryCache(pstReuse, nReplaySize);
+
+        // 整体释放会清空段
+        stHeap.Destroy();
+        assert(stHeap.GetRoot("room") == nullptr);
+        assert(stHeap.GetSystemCacheSize() == 0);
+    }
+
+    // 多次重启：每次分配后全部释放，退出时线程缓存和中心缓存的空闲块留给下次挂载复用，段的使用量不增长
+    size_t nUsedSize = 0;
+    for (int nRestart = 0; nRestart < 6; ++nRestart)
+    {
+        MahjongHeap stHeap(stConfig);
+        assert(stHeap.IsPersistent());
+        std::vector<void*> vecCache;
+        for (int i = 0; i < 200; ++i)
+        {
+            vecCache.push_back(stHeap.NewMemoryCache(64));
+            vecCache.push_back(stHeap.NewMemoryCache(1000));
+        }
+        for (size_t i = 0; i < vecCache.size(); ++i)
+        {
+            stHeap.DeleteMemoryCache(vecCache[i], i % 2 == 0 ? 64 : 1000);
+        }
+
+        if (nRestart == 0)
+        {
+            nUsedSize = stHeap.GetSystemCacheSize();
+        }
+        assert(stHeap.GetSystemCacheSize() == nUsedSize);
+    }
+
+    MahjongPersistentSegment::Remove(stConfig.m_strPersistentName);
+    std::cout << "结束执行单元测试 UnitTestPersistentHeap end" << std::endl;
+}
+
+// 内存上限测试：超过软上限时清空缓存并回调，超过硬上限时分配失败
+void UnitTestHeapLimit()
+{
+    std::cout << "开始执行单元测试 UnitTestHeapLimit start" << std::endl;
+    size_t nCallbackNum = 0;
+    MahjongHeapConfig stConfig;
+    stConfig.m_nSoftLimit = 2 * 1024 * 1024;
+    stConfig.m_nHardLimit = 4 * 1024 * 1024;
+    stConfig.m_fnSoftLimitCallback = [&nCallbackNum, &stConfig](size_t nSystemCacheSize)
+    {
+        assert(nSystemCacheSize <= stConfig.m_nHardLimit);
+        nCallbackNum++;
+    };
+    MahjongHeap stHeap(stConfig);
+
+    // 小对象全部释放后，线程缓存和中心缓存中的span可以整体归还系统
+    std::vector<void*> vecCache;
+    for (int i = 0; i < 1000; ++i)
+    {
+        vecCache.push_back(stHeap.NewMemoryCache(1024));
+    }
+    for (void* ptr : vecCache)
+    {
+        stHeap.DeleteMemoryCache(ptr, 1024);
+    }
+    assert(stHeap.ReleaseFreeMemory() > 0);
+    assert(stHeap.GetSystemCacheSize() == 0);
+    assert(nCallbackNum == 0);
+
+    // 大对象持续分配直到硬上限，超过软上限时触发回调
+    const size_t nLargeSize = MAX_BYTES * 2;
+    vecCache.clear();
+    for (void* ptr = stHeap.NewMemoryCache(nLargeSize); ptr != nullptr; ptr = stHeap.NewMemoryCache(nLargeSize))
+    {
+        vecCache.push_back(ptr);
+    }
+    assert(vecCache.size() == stConfig.m_nHardLimit / nLargeSize);
+    assert(stHeap.GetSystemCacheSize() <= stConfig.m_nHardLimit);
+    assert(nCallbackNum > 0);
+
+    // 释放后可以继续分配
+    stHeap.DeleteMemoryCache(vecCache.back(), nLargeSize);
+    vecCache.back() = stHeap.NewMemoryCache(nLargeSize);
+    assert(vecCache.back() != nullptr);
+
+    for (void* ptr : vecCache)
+    {
+        stHeap.DeleteMemoryCache(ptr, nLargeSize);
+    }
+    stHeap.ReleaseFreeMemory();
+    assert(stHeap.GetSystemCacheSize() == 0);
+
+    // 处理软上限期间再次越过软上限（等同其他线程正在清空缓存），标记保留到处理结束后的下一次分配
+    size_t nNestedNum = 0;
+    MahjongHeap* pstNestedHeap = nullptr;
+    MahjongHeapConfig stNestedConfig;
+    stNestedConfig.m_nSoftLimit = stConfig.m_nSoftLimit;
+    stNestedConfig.m_fnSoftLimitCallback = [&nNestedNum, &pstNestedHeap, &vecCache, &stNestedConfig, nLargeSize](size_t)
+    {
+        if (nNestedNum++ != 0)
+        {
+            return;
+        }
+        for (void* ptr : vecCache)
+        {
+            pstNestedHeap->DeleteMemoryCache(ptr, nLargeSize);
+        }
+        vecCache.clear();
+        pstNestedHeap->ReleaseFreeMemory();
+        while (pstNestedHeap->GetSystemCacheSize() <= stNestedConfig.m_nSoftLimit)
+        {
+            vecCache.push_back(pstNestedHeap->NewMemoryCache(nLargeSize));
+        }
+    };
+    MahjongHeap stNestedHeap(stNestedConfig);
+    pstNestedHeap = &stNestedHeap;
+    vecCache.clear();
+    while (nNestedNum == 0)
+    {
+        vecCache.push_back(stNestedHeap.NewMemoryCache(nLargeSize));
+    }
+    assert(nNestedNum == 1);
+    vecCache.push_back(stNestedHeap.NewMemoryCache(nLargeSize));
+    assert(nNestedNum == 2);
+    for (void* ptr : vecCache)
+    {
+        stNestedHeap.DeleteMemoryCache(ptr, nLargeSize);
+    }
+
+    // 一个线程停在软上限回调中时，另一个线程达到硬上限仍要清空自己缓存的空闲块后重试
+    std::atomic<int> nCallbackState{ 0 };
+    MahjongHeapConfig stBusyConfig;
+    stBusyConfig.m_nSoftLimit = stConfig.m_nSoftLimit;
+    stBusyConfig.m_nHardLimit = stConfig.m_nHardLimit;
+    stBusyConfig.m_fnSoftLimitCallback = [&nCallbackState](size_t)
+    {
+        nCallbackState.store(1);
+        while (nCallbackState.load() != 2)
+        {
+            std::this_thread::yield();
+        }
+    };
+    MahjongHeap stBusyHeap(stBusyConfig);
+    std::thread stCallbackThread([&stBusyHeap, &stBusyConfig, nLargeSize]()
+    {
+        std::vector<void*> vecLarge;
+        while (stBusyHeap.GetSystemCacheSize() <= stBusyConfig.m_nSoftLimit)
+        {
+            vecLarge.push_back(stBusyHeap.NewMemoryCache(nLargeSize));
+        }
+        for (void* ptr : vecLarge)
+        {
+            stBusyHeap.DeleteMemoryCache(ptr, nLargeSize);
+        }
+    });
+    while (nCallbackState.load() != 1)
+    {
+        std::this_thread::yield();
+    }
+
+    // 小对象占满到硬上限后全部释放，空闲块留在本线程缓存和中心缓存中
+    vecCache.clear();
+    for (void* ptr = stBusyHeap.NewMemoryCache(1024); ptr != nullptr; ptr = stBusyHeap.NewMemoryCache(1024))
+    {
+        vecCache.push_back(ptr);
+    }
+    for (void* ptr : vecCache)
+    {
+        stBusyHeap.DeleteMemoryCache(ptr, 1024);
+    }
+    void* pstLarge = stBusyHeap.NewMemoryCache(nLargeSize);
+    assert(pstLarge != nullptr);
+    stBusyHeap.DeleteMemoryCache(pstLarge, nLargeSize);
+
+    nCallbackState.store(2);
+    stCallbackThread.join();
+    std::cout << "结束执行单元测试 UnitTestHeapLimit end" << std::endl;
+}
+
+// 碎片报告测试：span占用、尾部浪费、大对象取整浪费和空闲页统计
+void UnitTestHeapReport()
+{
+    std::cout << "开始执行单元测试 UnitTestHeapReport start" << std::endl;
+    MahjongHeap stHeap;
+
+    // 1000字节的块每个span切32块，尾部浪费768字节
+    std::vector<void*> vecCache;
+    for (int i = 0; i < 100; ++i)
+    {
+        vecCache.push_back(stHeap.NewMemoryCache(1000));
+    }
+    for (size_t i = 0; i < vecCache.size(); i += 2)
+    {
+        stHeap.DeleteMemoryCache(vecCache[i], 1000);
+    }
+
+    const size_t nLargeSize = MAX_BYTES + 100;
+    void* pstLarge = stHeap.NewMemoryCache(nLargeSize);
+
+    MahjongHeapReport stReport = stHeap.GetReport();
+    assert(stReport.m_vecSizeClass.size() == 1);
+    const MahjongSizeClassReport& stClass = stReport.m_vecSizeClass[0];
+    assert(stClass.m_nObjectSize == 1000);
+    assert(stClass.m_nBlockNum == stClass.m_nSpanNum * 32);
+    assert(stClass.m_nTailWasteSize == stClass.m_nSpanNum * 768);
+    size_t nSpanNum = 0;
+    for (size_t nNum : stClass.m_arrOccupancy)
+    {
+        nSpanNum += nNum;
+    }
+    assert(nSpanNum == stClass.m_nSpanNum);
+    assert(stReport.m_nLargeWasteSize == MahjongPageCache::GetPageNumBySize(nLargeSize) * MahjongPageCache::PAGESIZE - nLargeSize);
+    assert(stReport.m_nThreadCacheSize >= 50 * 1000);
+    assert(stReport.m_nSmallSpanSize + stReport.m_nLargeSpanSize + stReport.m_nThreadStashSize
+        + stReport.m_nFreePageNum * MahjongPageCache::PAGESIZE == stReport.m_nSystemCacheSize);
+
+    // 大对象释放后成为空闲页
+    stHeap.DeleteMemoryCache(pstLarge, nLargeSize);
+    stReport = stHeap.GetReport();
+    assert(stReport.m_nLargeSpanSize == 0 && stReport.m_nLargeWasteSize == 0);
+    assert(stReport.m_nLargestFreeRunPageNum >= MahjongPageCache::GetPageNumBySize(nLargeSize));
+    assert(!stReport.m_vecFreeRun.empty());
+    assert(stReport.ToString().find("class 1000 ") != std::string::npos);
+
+    for (size_t i = 1; i < vecCache.size(); i += 2)
+    {
+        stHeap.DeleteMemoryCache(vecCache[i], 1000);
+    }
+
+    // 页暂存区中尚未切分的span单独统计，不计入大对象
+    MahjongHeap stStashHeap;
+    void* pstSmall = stStashHeap.NewMemoryCache(64);
+    stReport = stStashHeap.GetReport();
+    const size_t nSpanSize = PAGECACHESIZE * MahjongPageCache::PAGESIZE;
+    assert(stReport.m_nSmallSpanSize == nSpanSize);
+    assert(stReport.m_nLargeSpanSize == 0);
+    assert(stReport.m_nThreadStashSize == (PAGESTASHNUM - 1) * nSpanSize);
+    assert(stReport.m_nSmallSpanSize + stReport.m_nThreadStashSize == stReport.m_nSystemCacheSize);
+    stStashHeap.DeleteMemoryCache(pstSmall, 64);
+    std::cout << "结束执行单元测试 UnitTestHeapReport end" << std::endl;
+}
+
+// 多线程同时冷启动分配，输出耗时和页缓存分片锁的竞争统计
+static void RunPageCacheRefill(const char* pszName, const MahjongHeapConfig& stConfig, size_t nThreadNum, size_t nBlockNum)
+{
+    MahjongHeap stHeap(stConfig);
+    std::atomic<bool> bStart{ false };
+    std::vector<std::thread> vecThread;
+    for (size_t i = 0; i < nThreadNum; ++i)
+    {
+        vecThread.emplace_back([&stHeap, &bStart, nBlockNum, i]()
+        {
+            while (!bStart.load(std::memory_order_acquire))
+            {
+                std::this_thread::yield();
+            }
+
+            // 每个线程持有大量不同尺寸的块，中心缓存需要不断向页缓存补充span
+            std::vector<std::pair<void*, size_t>> vecCache;
+            vecCache.reserve(nBlockNum);
+            for (size_t j = 0; j < nBlockNum; ++j)
+            {
+                size_t nSize = ((i * 131 + j * 61) % 256 + 1) * 16;
+                vecCache.emplace_back(stHeap.NewMemoryCache(nSize), nSize);
+            }
+            for (auto& stCache : vecCache)
+            {
+                stHeap.DeleteMemoryCache(stCache.first, stCache.second);
+            }
+        });
+    }
+
+    auto tStart = std::chrono::steady_clock::now();
+    bStart.store(true, std::memory_order_release);
+    for (auto& thread : vecThread)
+    {
+        thread.join();
+    }
+    double dTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tStart).count();
+
+    MahjongPageCache& stPageCache = stHeap.GetPageCache();
+    std::cout << pszName << ": " << dTime << " ms, 分片锁等待 " << stPageCache.GetLockWaitNum() << " 次 共 "
+        << stPageCache.GetLockWaitTime() / 1e6 << " ms, 跳过正忙分片 " << stPageCache.GetTryLockFailNum() << " 次" << std::endl;
+}
+
+// 页缓存补充压测：64个线程冷启动，对比单分片无暂存区与默认的分片加线程页暂存区
+void BenchmarkPageCacheRefill()
+{
+    std::cout << "开始执行压测 BenchmarkPageCacheRefill start" << std::endl;
+    const size_t nThreadNum = 64;
+    const size_t nBlockNum = 1000;
+
+    MahjongHeapConfig stSingleConfig;
+    stSingleConfig.m_nPageShardNum = 1;
+    stSingleConfig.m_nPageStashNum = 0;
+    MahjongHeapConfig stShardConfig;
+
+    std::string strShardName = std::to_string(stShardConfig.m_nPageShardNum) + "分片+暂存区"
+        + std::to_string(stShardConfig.m_nPageStashNum);
+    RunPageCacheRefill("单分片无暂存区", stSingleConfig, nThreadNum, nBlockNum);
+    RunPageCacheRefill(strShardName.c_str(), stShardConfig, nThreadNum, nBlockNum);
+    std::cout << "结束执行压测 BenchmarkPageCacheRefill end" << std::endl;
+}
+
 // 边界测试
 void UnitTestEdgeCasess() 
 {
@@ -120,8 +744,13 @@ void UnitTestEdgeCasess()
 
 
 
-int main()
+int main(int argc, char* argv[])
 {
 	cout << "Hello CMake." << endl;
+	// 带bench参数时运行压测
+	if (argc > 1 && strcmp(argv[1], "bench") == 0)
+	{
+		BenchmarkPageCacheRefill();
+	}
 	return 0;
 }
@@ -5,5 +5,16 @@
 #pragma once
 
 #include <iostream>
+#include <cassert>
+#include <cstring>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <fstream>
+#include <sys/socket.h>
+#include <unistd.h>
 
 // TODO: 在此处引用程序需要的其他标头。
@@ -8,6 +8,8 @@
 #include <cstddef>
 #include <atomic>
 #include <array>
+#include <functional>
+#include <string>
 
 namespace MahjongMemoryPool
 {
@@ -20,6 +22,31 @@ namespace MahjongMemoryPool
     // 设定自由链表的大小
     static const size_t SystemThreshold = 64;
     static const size_t MAXBATCHSIZE = 4 * 1024; // 4kb
+    // 中心缓存每次向页缓存申请的页数
+    static const size_t PAGECACHESIZE = 8;
+    // 页缓存分片数
+    static const size_t PAGESHARDNUM = 8;
+    // 线程页暂存区默认和最大的span个数
+    static const size_t PAGESTASHNUM = 4;
+    static const size_t MAXPAGESTASHNUM = 16;
+    // 预热最多映射的字节数，防止损坏或不匹配的画像在启动时耗尽内存
+    static const size_t MAXPREWARMSIZE = 256 * 1024 * 1024;
+
+    // 堆配置，每个MahjongHeap实例独立持有
+    struct MahjongHeapConfig
+    {
+        size_t m_nSpanPageNum = PAGECACHESIZE;           // 中心缓存每次申请的span页数
+        size_t m_nThreadCacheThreshold = SystemThreshold; // 线程缓存自由链表触发归还的阈值
+        size_t m_nMaxBatchSize = MAXBATCHSIZE;           // 线程缓存单次批量获取的最大字节数
+        size_t m_nPageShardNum = PAGESHARDNUM;           // 页缓存分片数，各分片独立加锁，持久化堆固定为1
+        size_t m_nPageStashNum = PAGESTASHNUM;           // 线程页暂存区的span个数（不超过MAXPAGESTASHNUM），0表示不启用
+        std::string m_strPersistentName;                 // 持久化段名字（如"/mahjong_lobby"），为空时不启用
+        uintptr_t m_nPersistentAddr = 0;                 // 持久化段映射的固定地址
+        size_t m_nPersistentSize = 0;                    // 持久化段大小
+        size_t m_nSoftLimit = 0;                         // 向系统申请字节数的软上限，越过时清空各级缓存并回调，0表示不限制
+        size_t m_nHardLimit = 0;                         // 向系统申请字节数的硬上限，超过时分配失败返回nullptr，0表示不限制
+        std::function<void(size_t)> m_fnSoftLimitCallback; // 超过软上限并清空缓存后调用，参数为当前向系统申请的字节数
+    };
 
     // 内存块头部信息结构体
     struct BlockHeader
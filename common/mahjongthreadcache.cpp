@@ -1,9 +1,20 @@
 #include "mahjongthreadcache.h"
-#include "majhongcentralcache.h"
+#include <cstring>
+#include "majhongheap.h"
 // 麻将线程缓存类 - 用于管理线程本地内存块的分配和释放
 // (采用类似TCMalloc线程缓存机制的设计)
 namespace MahjongMemoryPool 
 {
+    MahjongThreadCache::MahjongThreadCache(MahjongHeap* pstHeap)
+        : m_pstHeap(pstHeap)
+        , m_nFlushEpoch(pstHeap->GetFlushEpoch())
+        , m_bPageStash(pstHeap->GetConfig().m_nPageStashNum > 0 && !pstHeap->IsPersistent())
+    {
+        m_FreeList.fill(nullptr);
+        m_FreeListSize.fill(0);
+        m_UseMask.fill(0);
+    }
+
   // 分配指定大小的内存块
     void* MahjongThreadCache::MahjongNewCache(size_t nSize)
     {
@@ -13,16 +24,14 @@ namespace MahjongMemoryPool
             nSize = ALIGNMENT;  // ALIGNMENT应为预定义的内存对齐值（如8/16字节）
         }
 
-        // 大对象直接走系统分配
+        // 大对象直接按页向页缓存申请整块span
         if (nSize > MAX_BYTES)  // MAX_BYTES应为小对象阈值（如256KB）
         {
-            // 注意：这里参数应为nSize，原代码中的size可能是笔误
-            return malloc(nSize);
+            return GetCacheByPageCache(nSize);
         }
 
         // 通过大小分类器获取对应的自由链表索引
         size_t nIndex = MahJongSizeClass::GetIndex(nSize);
-        m_FreeListSize[nIndex]--;  // 减少对应链表的可用计数
 
         // 尝试从自由链表获取缓存块
         void* pstTemp = m_FreeList[nIndex];
@@ -30,6 +39,8 @@ namespace MahjongMemoryPool
         {
             // 使用链表头部的块，并更新链表头为下一个节点
             m_FreeList[nIndex] = *reinterpret_cast<void**>(pstTemp);
+            m_FreeListSize[nIndex]--;  // 减少对应链表的可用计数
+            SubFreeCacheSize((nIndex + 1) * ALIGNMENT);
             return pstTemp;
         }
 
@@ -40,10 +51,10 @@ namespace MahjongMemoryPool
     // 释放内存块到线程缓存
     void MahjongThreadCache::MahjongDeleteCache(void* pstCache, size_t nSize)
     {
-        // 大对象直接释放给系统
+        // 大对象直接归还页缓存
         if (nSize > MAX_BYTES)
         {
-            free(pstCache);
+            m_pstHeap->GetPageCache().DeleteCacheByPageNum(pstCache, MahjongPageCache::GetPageNumBySize(nSize));
             return;
         }
 
@@ -51,15 +62,67 @@ namespace MahjongMemoryPool
         size_t nIndex = MahJongSizeClass::GetIndex(nSize);
 
         // 将释放的块插入链表头部
+        if (m_FreeList[nIndex] == nullptr)
+        {
+            SetUseMask(nIndex);
+        }
         *reinterpret_cast<void**>(pstCache) = m_FreeList[nIndex];
         m_FreeList[nIndex] = pstCache;
         m_FreeListSize[nIndex]++;  // 增加可用计数
+        AddFreeCacheSize((nIndex + 1) * ALIGNMENT);
 
         // 检查是否需要归还部分缓存到中心缓存
         if (CheckIsReturnCacheToByCacheCentral(nIndex))
         {
-            SetCacheToCentralCache(m_FreeList[nIndex], nSize);
+            if (IsFlushRequested())
+            {
+                ReleaseAllCache();
+            }
+            else
+            {
+                SetCacheToCentralCache(m_FreeList[nIndex], nSize);
+            }
+        }
+    }
+
+    // 调整内存块大小，同一尺寸类内原地返回
+    void* MahjongThreadCache::MahjongResizeCache(void* pstCache, size_t nOldSize, size_t nNewSize)
+    {
+        if (pstCache == nullptr)
+        {
+            return MahjongNewCache(nNewSize);
+        }
+
+        nOldSize = std::max(nOldSize, ALIGNMENT);
+        nNewSize = std::max(nNewSize, ALIGNMENT);
+
+        if (nOldSize <= MAX_BYTES && nNewSize <= MAX_BYTES)
+        {
+            // 小对象：新旧大小落在同一个自由链表时无需搬移
+            if (MahJongSizeClass::GetIndex(nOldSize) == MahJongSizeClass::GetIndex(nNewSize))
+            {
+                return pstCache;
+            }
+        }
+        else if (nOldSize > MAX_BYTES && nNewSize > MAX_BYTES)
+        {
+            // 大对象：尝试在页缓存中原地缩小或并入相邻空闲span
+            if (m_pstHeap->GetPageCache().ResizeCacheByPageNum(pstCache, MahjongPageCache::GetPageNumBySize(nNewSize), nNewSize))
+            {
+                return pstCache;
+            }
+        }
+
+        // 无法原地调整时退化为分配-拷贝-释放
+        void* pstNewCache = MahjongNewCache(nNewSize);
+        if (pstNewCache == nullptr)
+        {
+            return nullptr;
         }
+
+        memcpy(pstNewCache, pstCache, std::min(nOldSize, nNewSize));
+        MahjongDeleteCache(pstCache, nOldSize);
+        return pstNewCache;
     }
 
     // 从中心缓存获取批量内存块
@@ -71,33 +134,74 @@ namespace MahjongMemoryPool
         // 获取建议的批量数量（根据内存大小决定）
         size_t nBatchNum = GetBatchNumByCentralCache(nSize);
 
-        // 从中心缓存获取内存块范围
-        void* pstStart = MahjongCentralCache::GetInstance().GetCacheByRange(nIndex, nBatchNum);
+        if (IsFlushRequested())
+        {
+            ReleaseAllCache();
+        }
+
+        // 从中心缓存获取内存块范围，达到硬上限时清空缓存后重试一次
+        MahjongPageStash* pstStash = m_bPageStash ? &m_stPageStash : nullptr;
+        void* pstStart = m_pstHeap->GetCentralCache().GetCacheByRange(nIndex, nBatchNum, pstStash);
+        if (pstStart == nullptr)
+        {
+            m_pstHeap->ReleaseFreeMemoryByHardLimit();
+            pstStart = m_pstHeap->GetCentralCache().GetCacheByRange(nIndex, nBatchNum, pstStash);
+        }
         if (pstStart == nullptr)
         {
             return nullptr;
         }
 
-        // 更新本地缓存链表（可能需要修改）
-        // 注意：原代码此处m_FreeList[nIndex] += nBatchNum; 可能存在问题，应为链表操作
-        // 正确实现可能需要将批量获取的块链接到自由链表
-
         void* pstResult = pstStart;  // 返回第一个可用块
 
-        if (nBatchNum > 1)
+        // 将剩余块链接到自由链表头部，并按实际取到的数量更新计数
+        void* pstNext = *reinterpret_cast<void**>(pstStart);
+        if (pstNext != nullptr)
         {
-            // 将剩余块链接到自由链表
-            m_FreeList[nIndex] = *reinterpret_cast<void**>(pstStart);
+            void* pstEnd = pstNext;
+            size_t nCount = 1;
+            while (*reinterpret_cast<void**>(pstEnd) != nullptr)
+            {
+                pstEnd = *reinterpret_cast<void**>(pstEnd);
+                nCount++;
+            }
+
+            if (m_FreeList[nIndex] == nullptr)
+            {
+                SetUseMask(nIndex);
+            }
+            *reinterpret_cast<void**>(pstEnd) = m_FreeList[nIndex];
+            m_FreeList[nIndex] = pstNext;
+            m_FreeListSize[nIndex] += nCount;
+            AddFreeCacheSize(nCount * nSize);
         }
 
+        // 此时不持有任何锁，可以处理页缓存标记的内存压力
+        m_pstHeap->CheckMemoryPressure();
         return pstResult;
     }
 
+    // 大对象直接向页缓存申请整块span
+    void* MahjongThreadCache::GetCacheByPageCache(size_t nSize)
+    {
+        size_t nPageNum = MahjongPageCache::GetPageNumBySize(nSize);
+        void* pstCache = m_pstHeap->GetPageCache().NewCacheByPageNum(nPageNum, nSize);
+        if (pstCache == nullptr)
+        {
+            m_pstHeap->ReleaseFreeMemoryByHardLimit();
+            pstCache = m_pstHeap->GetPageCache().NewCacheByPageNum(nPageNum, nSize);
+        }
+        if (pstCache != nullptr)
+        {
+            m_pstHeap->CheckMemoryPressure();
+        }
+        return pstCache;
+    }
+
     // 归还多余缓存到中心缓存
     void MahjongThreadCache::SetCacheToCentralCache(void* pstCacheStart, size_t nSize)
     {
         size_t nIndex = MahJongSizeClass::GetIndex(nSize);
-        size_t nAlignedSize = MahJongSizeClass::RoundUp(nSize);  // 获取对齐后的大小
 
         size_t nBatchNum = m_FreeListSize[nIndex];
         if (nBatchNum <= 1)  // 数量太少无需归还
@@ -109,17 +213,11 @@ namespace MahjongMemoryPool
         size_t nKeepNum = std::max(nBatchNum / 4, size_t(1));
         size_t nResultNum = nBatchNum - nKeepNum;  // 实际归还数量
 
-        // 遍历链表找到分割点
-        char* pstCurrent = static_cast<char*>(pstCacheStart);
-        char* pstNode = pstCurrent;
-        for (size_t i = 0; i < nKeepNum; ++i)
+        // 遍历链表找到分割点（保留部分的最后一个节点）
+        void* pstNode = pstCacheStart;
+        for (size_t i = 1; i < nKeepNum && pstNode != nullptr; ++i)
         {
-            pstNode = reinterpret_cast<char*>(reinterpret_cast<void**>(pstNode));
-            if (pstNode == nullptr)  // 链表长度不足时调整
-            {
-                nResultNum = nBatchNum - (i + 1);
-                break;
-            }
+            pstNode = *reinterpret_cast<void**>(pstNode);
         }
 
         if (pstNode != nullptr)
@@ -131,19 +229,65 @@ namespace MahjongMemoryPool
             // 更新本地缓存信息
             m_FreeList[nIndex] = pstCacheStart;
             m_FreeListSize[nIndex] = nKeepNum;
+            SubFreeCacheSize(nResultNum * (nIndex + 1) * ALIGNMENT);
 
             // 归还剩余块到中心缓存
             if (nResultNum > 0 && pstNextNode != nullptr)
             {
-                MahjongCentralCache::GetInstance().SetCacheByRange(
+                m_pstHeap->GetCentralCache().SetCacheByRange(
                     pstNextNode,
-                    nResultNum * nAlignedSize,
+                    nResultNum,
                     nIndex
                 );
             }
         }
     }
 
+    // 把所有自由链表中的块归还中心缓存
+    void MahjongThreadCache::ReleaseAllCache()
+    {
+        m_nFlushEpoch = m_pstHeap->GetFlushEpoch();
+        // 只检查上次整体归还后链表变为非空过的尺寸类，硬上限下反复分配失败时不必每次扫描全部尺寸类
+        for (size_t nWord = 0; nWord < m_UseMask.size(); ++nWord)
+        {
+            uint64_t nMask = m_UseMask[nWord];
+            m_UseMask[nWord] = 0;
+            while (nMask != 0)
+            {
+                size_t nIndex = nWord * 64 + static_cast<size_t>(__builtin_ctzll(nMask));
+                nMask &= nMask - 1;
+                if (m_FreeList[nIndex] == nullptr)
+                {
+                    continue;
+                }
+
+                m_pstHeap->GetCentralCache().SetCacheByRange(m_FreeList[nIndex], m_FreeListSize[nIndex], nIndex);
+                m_FreeList[nIndex] = nullptr;
+                m_FreeListSize[nIndex] = 0;
+            }
+        }
+        m_nFreeCacheSize.store(0, std::memory_order_relaxed);
+
+        // 暂存的span还给页缓存
+        m_pstHeap->GetPageCache().ReleaseStash(m_stPageStash);
+    }
+
+    // 标记尺寸类的自由链表变为非空
+    void MahjongThreadCache::SetUseMask(size_t nIndex)
+    {
+        m_UseMask[nIndex / 64] |= uint64_t(1) << (nIndex % 64);
+    }
+
+    void MahjongThreadCache::AddFreeCacheSize(size_t nSize)
+    {
+        m_nFreeCacheSize.store(m_nFreeCacheSize.load(std::memory_order_relaxed) + nSize, std::memory_order_relaxed);
+    }
+
+    void MahjongThreadCache::SubFreeCacheSize(size_t nSize)
+    {
+        m_nFreeCacheSize.store(m_nFreeCacheSize.load(std::memory_order_relaxed) - nSize, std::memory_order_relaxed);
+    }
+
     // 根据对象大小确定批量获取数量
     size_t MahjongThreadCache::GetBatchNumByCentralCache(size_t nSize)
     {
@@ -176,14 +320,20 @@ namespace MahjongMemoryPool
         }
 
         // 计算最大批量数（不超过总缓存大小）
-        size_t nMaxNum = std::max(size_t(1), MAXBATCHSIZE / nSize);
+        size_t nMaxNum = std::max(size_t(1), m_pstHeap->GetConfig().m_nMaxBatchSize / nSize);
         return std::max(size_t(1), std::min(nMaxNum, nBaseNum));
     }
 
+    // 其他线程处理内存压力后要求所有线程缓存整体归还
+    bool MahjongThreadCache::IsFlushRequested() const
+    {
+        return m_nFlushEpoch != m_pstHeap->GetFlushEpoch();
+    }
+
     // 检查是否需要归还缓存到中心缓存
     bool MahjongThreadCache::CheckIsReturnCacheToByCacheCentral(size_t nIndex)
     {
         // 当自由链表中的块数超过系统阈值时触发归还
-        return (m_FreeListSize[nIndex] > SystemThreshold);  // SystemThreshold应为预定义阈值
+        return (m_FreeListSize[nIndex] > m_pstHeap->GetConfig().m_nThreadCacheThreshold);
     }
 }
@@ -6,23 +6,30 @@
 */
 #pragma  once
 #include "common.h"
+#include "majhongpagecache.h"
 
 namespace MahjongMemoryPool 
 {
-    // 线程本地缓存
+    class MahjongHeap;
+
+    // 线程本地缓存，每个线程在每个堆上各有一份，由所属MahjongHeap创建和回收
     class MahjongThreadCache
     {
     public:
-        static MahjongThreadCache* GetInstance()
-        {
-            static thread_local MahjongThreadCache stThreadCacheInstance;
-            return &stThreadCacheInstance;
-        }
+        explicit MahjongThreadCache(MahjongHeap* pstHeap);
 
         void* MahjongNewCache(size_t nSize);
         void  MahjongDeleteCache(void* pstCache, size_t nSize);
+        // 调整内存块大小，能原地调整时返回原指针
+        void* MahjongResizeCache(void* pstCache, size_t nOldSize, size_t nNewSize);
+        // 把所有自由链表中的块归还中心缓存（线程退出时调用）
+        void ReleaseAllCache();
+        // 自由链表中空闲块的总字节数，可由其他线程读取
+        size_t GetFreeCacheSize() const
+        {
+            return m_nFreeCacheSize.load(std::memory_order_relaxed);
+        }
     private:
-        MahjongThreadCache() = default;
         // 获取内存从中心缓存
         void* GetCacheByCentralCache(size_t nIndex);
         // 设置内存到中心缓存
@@ -31,10 +38,30 @@ namespace MahjongMemoryPool
         size_t GetBatchNumByCentralCache(size_t nSize);
         // 判断是否需要归还内存给中心缓存
         bool CheckIsReturnCacheToByCacheCentral(size_t nSize);
+        // 其他线程处理内存压力后要求所有线程缓存整体归还
+        bool IsFlushRequested() const;
+        // 大对象直接向页缓存申请整块span
+        void* GetCacheByPageCache(size_t nSize);
+        // 空闲字节数只由所属线程修改，不需要原子读改写
+        void AddFreeCacheSize(size_t nSize);
+        void SubFreeCacheSize(size_t nSize);
+        // 标记尺寸类的自由链表变为非空
+        void SetUseMask(size_t nIndex);
     private:
+        // 所属的堆
+        MahjongHeap* m_pstHeap;
         // 每个线程的自由链表数组
         std::array<void*, FREE_LIST_SIZE> m_FreeList;
         // 自由链表大小统计
         std::array<size_t, FREE_LIST_SIZE> m_FreeListSize;
+        // 上次整体归还后自由链表变为非空过的尺寸类（每位一个尺寸类），整体归还时只检查这些尺寸类
+        std::array<uint64_t, (FREE_LIST_SIZE + 63) / 64> m_UseMask;
+        // 最近一次整体归还时堆的归还轮次
+        uint64_t m_nFlushEpoch;
+        // 自由链表中空闲块的总字节数
+        std::atomic<size_t> m_nFreeCacheSize{ 0 };
+        // 页暂存区，中心缓存为本线程补充span时使用；持久化堆不启用，避免暂存的span在段中泄漏
+        MahjongPageStash m_stPageStash;
+        bool m_bPageStash;
     };
 }
@@ -0,0 +1,385 @@
+#include <cstring>
+#include <new>
+#include <unistd.h>
+#include "majhongbufferchain.h"
+
+namespace MahjongMemoryPool
+{
+    MahjongBufferChain::MahjongBufferChain(MahjongHeap& stHeap, size_t nSegmentSize)
+        : m_pstHeap(&stHeap)
+        , m_nSegmentSize(std::max(nSegmentSize, sizeof(MahjongBufferSegment) + ALIGNMENT))
+        , m_nSize(0)
+        , m_nWriteSlice(0)
+    {
+    }
+
+    MahjongBufferChain::MahjongBufferChain(const MahjongBufferChain& stOther)
+        : m_pstHeap(stOther.m_pstHeap)
+        , m_nSegmentSize(stOther.m_nSegmentSize)
+        , m_nSize(0)
+        , m_nWriteSlice(0)
+    {
+        Append(stOther);
+    }
+
+    MahjongBufferChain::MahjongBufferChain(MahjongBufferChain&& stOther) noexcept
+        : m_pstHeap(stOther.m_pstHeap)
+        , m_nSegmentSize(stOther.m_nSegmentSize)
+        , m_nSize(stOther.m_nSize)
+        , m_vecSlice(std::move(stOther.m_vecSlice))
+        , m_nWriteSlice(m_vecSlice.size())
+    {
+        stOther.m_vecSlice.clear();
+        stOther.m_nSize = 0;
+        stOther.m_nWriteSlice = 0;
+    }
+
+    MahjongBufferChain& MahjongBufferChain::operator=(const MahjongBufferChain& stOther)
+    {
+        if (this != &stOther)
+        {
+            Clear();
+            m_pstHeap = stOther.m_pstHeap;
+            m_nSegmentSize = stOther.m_nSegmentSize;
+            Append(stOther);
+        }
+        return *this;
+    }
+
+    MahjongBufferChain& MahjongBufferChain::operator=(MahjongBufferChain&& stOther) noexcept
+    {
+        if (this != &stOther)
+        {
+            Clear();
+            m_pstHeap = stOther.m_pstHeap;
+            m_nSegmentSize = stOther.m_nSegmentSize;
+            m_nSize = stOther.m_nSize;
+            m_vecSlice = std::move(stOther.m_vecSlice);
+            m_nWriteSlice = m_vecSlice.size();
+            stOther.m_vecSlice.clear();
+            stOther.m_nSize = 0;
+            stOther.m_nWriteSlice = 0;
+        }
+        return *this;
+    }
+
+    MahjongBufferChain::~MahjongBufferChain()
+    {
+        Clear();
+    }
+
+    // 追加数据：拷贝到尾段剩余空间或新段
+    void MahjongBufferChain::Append(const void* pData, size_t nSize)
+    {
+        const char* pstData = static_cast<const char*>(pData);
+        m_nSize += nSize;
+
+        // 先填满尾段剩余空间
+        if (nSize > 0 && IsTailWritable())
+        {
+            BufferSlice& stTail = m_vecSlice.back();
+            MahjongBufferSegment* pstSegment = stTail.m_pstSegment;
+            size_t nCopySize = std::min(nSize, size_t(pstSegment->m_nCapacity - pstSegment->m_nWriteOffset));
+            memcpy(pstSegment->GetData() + pstSegment->m_nWriteOffset, pstData, nCopySize);
+            pstSegment->m_nWriteOffset += nCopySize;
+            stTail.m_nLength += nCopySize;
+            pstData += nCopySize;
+            nSize -= nCopySize;
+        }
+
+        // 剩余数据写入新段
+        while (nSize > 0)
+        {
+            MahjongBufferSegment* pstSegment = NewSegment(m_nSegmentSize - sizeof(MahjongBufferSegment));
+            size_t nCopySize = std::min(nSize, size_t(pstSegment->m_nCapacity));
+            memcpy(pstSegment->GetData(), pstData, nCopySize);
+            pstSegment->m_nWriteOffset = nCopySize;
+            m_vecSlice.push_back({ pstSegment, 0, uint32_t(nCopySize) });
+            pstData += nCopySize;
+            nSize -= nCopySize;
+        }
+        m_nWriteSlice = m_vecSlice.size();
+    }
+
+    // 追加另一条链：共享其所有段
+    void MahjongBufferChain::Append(const MahjongBufferChain& stOther)
+    {
+        // 先拷贝片段表，允许追加自身
+        std::vector<BufferSlice> vecSlice(stOther.m_vecSlice);
+        for (const BufferSlice& stSlice : vecSlice)
+        {
+            if (stSlice.m_nLength > 0)
+            {
+                AddRef(stSlice.m_pstSegment);
+                m_vecSlice.push_back(stSlice);
+            }
+        }
+        m_nSize += stOther.m_nSize;
+        m_nWriteSlice = m_vecSlice.size();
+    }
+
+    // 在头部插入协议头：只为头部分配一个新段
+    void MahjongBufferChain::Prepend(const void* pData, size_t nSize)
+    {
+        if (nSize == 0)
+        {
+            return;
+        }
+
+        MahjongBufferSegment* pstSegment = NewSegment(nSize);
+        memcpy(pstSegment->GetData(), pData, nSize);
+        pstSegment->m_nWriteOffset = nSize;
+        m_vecSlice.insert(m_vecSlice.begin(), { pstSegment, 0, uint32_t(nSize) });
+        m_nSize += nSize;
+        m_nWriteSlice = m_vecSlice.size();
+    }
+
+    // 在头部插入另一条链：共享其所有段
+    void MahjongBufferChain::Prepend(const MahjongBufferChain& stOther)
+    {
+        std::vector<BufferSlice> vecSlice;
+        for (size_t i = 0; i < stOther.m_vecSlice.size(); ++i)
+        {
+            if (stOther.m_vecSlice[i].m_nLength > 0)
+            {
+                AddRef(stOther.m_vecSlice[i].m_pstSegment);
+                vecSlice.push_back(stOther.m_vecSlice[i]);
+            }
+        }
+        m_vecSlice.insert(m_vecSlice.begin(), vecSlice.begin(), vecSlice.end());
+        m_nSize += stOther.m_nSize;
+        m_nWriteSlice = m_vecSlice.size();
+    }
+
+    // 取[nOffset, nOffset + nSize)的子链
+    MahjongBufferChain MahjongBufferChain::Slice(size_t nOffset, size_t nSize) const
+    {
+        MahjongBufferChain stResult(*m_pstHeap, m_nSegmentSize);
+        if (nOffset >= m_nSize)
+        {
+            return stResult;
+        }
+        nSize = std::min(nSize, m_nSize - nOffset);
+
+        for (size_t i = 0; i < m_vecSlice.size() && nSize > 0; ++i)
+        {
+            const BufferSlice& stSlice = m_vecSlice[i];
+            if (stSlice.m_nLength == 0 || nOffset >= stSlice.m_nLength)
+            {
+                nOffset -= stSlice.m_nLength;
+                continue;
+            }
+
+            size_t nLength = std::min(nSize, size_t(stSlice.m_nLength) - nOffset);
+            AddRef(stSlice.m_pstSegment);
+            stResult.m_vecSlice.push_back({ stSlice.m_pstSegment, uint32_t(stSlice.m_nOffset + nOffset), uint32_t(nLength) });
+            stResult.m_nSize += nLength;
+            nSize -= nLength;
+            nOffset = 0;
+        }
+        stResult.m_nWriteSlice = stResult.m_vecSlice.size();
+        return stResult;
+    }
+
+    // 丢弃头部nSize字节
+    void MahjongBufferChain::Consume(size_t nSize)
+    {
+        nSize = std::min(nSize, m_nSize);
+        m_nSize -= nSize;
+
+        size_t nDropNum = 0;
+        while (nSize > 0 && nDropNum < m_vecSlice.size())
+        {
+            BufferSlice& stSlice = m_vecSlice[nDropNum];
+            if (nSize < stSlice.m_nLength)
+            {
+                stSlice.m_nOffset += nSize;
+                stSlice.m_nLength -= nSize;
+                break;
+            }
+
+            nSize -= stSlice.m_nLength;
+            Release(stSlice.m_pstSegment);
+            nDropNum++;
+        }
+        m_vecSlice.erase(m_vecSlice.begin(), m_vecSlice.begin() + nDropNum);
+        m_nWriteSlice = m_vecSlice.size();
+    }
+
+    // 拷贝出头部最多nSize字节
+    size_t MahjongBufferChain::CopyTo(void* pDest, size_t nSize) const
+    {
+        char* pstDest = static_cast<char*>(pDest);
+        size_t nCopyTotal = 0;
+        for (size_t i = 0; i < m_vecSlice.size() && nCopyTotal < nSize; ++i)
+        {
+            const BufferSlice& stSlice = m_vecSlice[i];
+            size_t nCopySize = std::min(nSize - nCopyTotal, size_t(stSlice.m_nLength));
+            memcpy(pstDest + nCopyTotal, stSlice.m_pstSegment->GetData() + stSlice.m_nOffset, nCopySize);
+            nCopyTotal += nCopySize;
+        }
+        return nCopyTotal;
+    }
+
+    void MahjongBufferChain::Clear()
+    {
+        for (BufferSlice& stSlice : m_vecSlice)
+        {
+            Release(stSlice.m_pstSegment);
+        }
+        m_vecSlice.clear();
+        m_nSize = 0;
+        m_nWriteSlice = 0;
+    }
+
+    // 填充可读数据的iovec数组
+    size_t MahjongBufferChain::GetReadIovec(iovec* pstIovec, size_t nIovecNum) const
+    {
+        size_t nCount = 0;
+        for (size_t i = 0; i < m_vecSlice.size() && nCount < nIovecNum; ++i)
+        {
+            const BufferSlice& stSlice = m_vecSlice[i];
+            if (stSlice.m_nLength == 0)
+            {
+                continue;
+            }
+
+            pstIovec[nCount].iov_base = stSlice.m_pstSegment->GetData() + stSlice.m_nOffset;
+            pstIovec[nCount].iov_len = stSlice.m_nLength;
+            nCount++;
+        }
+        return nCount;
+    }
+
+    // 预留可写空间并填充iovec数组
+    size_t MahjongBufferChain::PrepareWriteIovec(size_t nSize, iovec* pstIovec, size_t nIovecNum)
+    {
+        size_t nCount = 0;
+        m_nWriteSlice = m_vecSlice.size();
+
+        // 尾段剩余空间优先使用
+        if (nSize > 0 && nIovecNum > 0 && IsTailWritable())
+        {
+            MahjongBufferSegment* pstSegment = m_vecSlice.back().m_pstSegment;
+            size_t nLength = std::min(nSize, size_t(pstSegment->m_nCapacity - pstSegment->m_nWriteOffset));
+            pstIovec[nCount].iov_base = pstSegment->GetData() + pstSegment->m_nWriteOffset;
+            pstIovec[nCount].iov_len = nLength;
+            nCount++;
+            nSize -= nLength;
+            m_nWriteSlice = m_vecSlice.size() - 1;
+        }
+
+        // 不够时追加空片段预留新段
+        while (nSize > 0 && nCount < nIovecNum)
+        {
+            MahjongBufferSegment* pstSegment = NewSegment(m_nSegmentSize - sizeof(MahjongBufferSegment));
+            size_t nLength = std::min(nSize, size_t(pstSegment->m_nCapacity));
+            m_vecSlice.push_back({ pstSegment, 0, 0 });
+            pstIovec[nCount].iov_base = pstSegment->GetData();
+            pstIovec[nCount].iov_len = nLength;
+            nCount++;
+            nSize -= nLength;
+        }
+        return nCount;
+    }
+
+    // 提交readv写入的数据
+    void MahjongBufferChain::CommitWrite(size_t nSize)
+    {
+        for (size_t i = m_nWriteSlice; i < m_vecSlice.size() && nSize > 0; ++i)
+        {
+            BufferSlice& stSlice = m_vecSlice[i];
+            MahjongBufferSegment* pstSegment = stSlice.m_pstSegment;
+            size_t nLength = std::min(nSize, size_t(pstSegment->m_nCapacity - pstSegment->m_nWriteOffset));
+            pstSegment->m_nWriteOffset += nLength;
+            stSlice.m_nLength += nLength;
+            m_nSize += nLength;
+            nSize -= nLength;
+        }
+
+        // 释放没有用到的预留段
+        while (!m_vecSlice.empty() && m_vecSlice.back().m_nLength == 0)
+        {
+            Release(m_vecSlice.back().m_pstSegment);
+            m_vecSlice.pop_back();
+        }
+        m_nWriteSlice = m_vecSlice.size();
+    }
+
+    // 从fd读取最多nSize字节追加到链尾
+    ssize_t MahjongBufferChain::ReadFromFd(int nFd, size_t nSize)
+    {
+        iovec arrIovec[16];
+        size_t nIovecNum = PrepareWriteIovec(nSize, arrIovec, 16);
+        ssize_t nReadSize = readv(nFd, arrIovec, static_cast<int>(nIovecNum));
+        CommitWrite(nReadSize > 0 ? size_t(nReadSize) : 0);
+        return nReadSize;
+    }
+
+    // 把链中数据写入fd并丢弃已写部分
+    ssize_t MahjongBufferChain::WriteToFd(int nFd)
+    {
+        iovec arrIovec[64];
+        size_t nIovecNum = GetReadIovec(arrIovec, 64);
+        if (nIovecNum == 0)
+        {
+            return 0;
+        }
+
+        ssize_t nWriteSize = writev(nFd, arrIovec, static_cast<int>(nIovecNum));
+        if (nWriteSize > 0)
+        {
+            Consume(size_t(nWriteSize));
+        }
+        return nWriteSize;
+    }
+
+    // 从堆中分配一个段
+    MahjongBufferSegment* MahjongBufferChain::NewSegment(size_t nCapacity)
+    {
+        void* pstCache = m_pstHeap->NewMemoryCache(sizeof(MahjongBufferSegment) + nCapacity);
+        if (pstCache == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+
+        MahjongBufferSegment* pstSegment = new (pstCache) MahjongBufferSegment;
+        pstSegment->m_nRefCount.store(1, std::memory_order_relaxed);
+        pstSegment->m_nCapacity = uint32_t(nCapacity);
+        pstSegment->m_nWriteOffset = 0;
+        pstSegment->m_pstHeap = m_pstHeap;
+        return pstSegment;
+    }
+
+    void MahjongBufferChain::AddRef(MahjongBufferSegment* pstSegment)
+    {
+        pstSegment->m_nRefCount.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // 引用计数归零时段归还堆
+    void MahjongBufferChain::Release(MahjongBufferSegment* pstSegment)
+    {
+        if (pstSegment->m_nRefCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+        {
+            size_t nSize = sizeof(MahjongBufferSegment) + pstSegment->m_nCapacity;
+            MahjongHeap* pstHeap = pstSegment->m_pstHeap;
+            pstSegment->~MahjongBufferSegment();
+            pstHeap->DeleteMemoryCache(pstSegment, nSize);
+        }
+    }
+
+    // 尾段是否可以继续追加
+    bool MahjongBufferChain::IsTailWritable() const
+    {
+        if (m_vecSlice.empty())
+        {
+            return false;
+        }
+
+        const BufferSlice& stTail = m_vecSlice.back();
+        const MahjongBufferSegment* pstSegment = stTail.m_pstSegment;
+        return pstSegment->m_nRefCount.load(std::memory_order_acquire) == 1
+            && stTail.m_nOffset + stTail.m_nLength == pstSegment->m_nWriteOffset
+            && pstSegment->m_nWriteOffset < pstSegment->m_nCapacity;
+    }
+}
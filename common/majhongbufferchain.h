@@ -0,0 +1,98 @@
+/*
+   @Time     : 2018/7/20 15:40
+   @Author   : 王一冰
+   @Describe : 基于内存池的零拷贝网络缓冲链
+   @Software : Copyright (c) 2018 中国手游娱乐集团有限公司
+*/
+#pragma once
+#include <sys/uio.h>
+#include <vector>
+#include "majhongheap.h"
+
+namespace MahjongMemoryPool
+{
+    // 缓冲段：段头后紧跟数据区，整块从堆的尺寸类中分配，引用计数归零时归还堆
+    struct MahjongBufferSegment
+    {
+        std::atomic<uint32_t> m_nRefCount;
+        uint32_t m_nCapacity;      // 数据区容量
+        uint32_t m_nWriteOffset;   // 数据区已写入的位置
+        MahjongHeap* m_pstHeap;    // 所属的堆
+
+        char* GetData()
+        {
+            return reinterpret_cast<char*>(this + 1);
+        }
+    };
+
+    // 缓冲链：由若干段的片段组成，拷贝、切片、拼接只增加段的引用计数，不拷贝数据
+    // 同一条链不是线程安全的；共享同一段的多条链可以在不同线程中使用和销毁
+    class MahjongBufferChain
+    {
+    public:
+        static const size_t SEGMENTSIZE = 2048;  // 每段总大小（含段头），落在池的小对象尺寸类上
+
+        explicit MahjongBufferChain(MahjongHeap& stHeap = MahjongHeap::GetDefaultHeap(), size_t nSegmentSize = SEGMENTSIZE);
+        MahjongBufferChain(const MahjongBufferChain& stOther);
+        MahjongBufferChain(MahjongBufferChain&& stOther) noexcept;
+        MahjongBufferChain& operator=(const MahjongBufferChain& stOther);
+        MahjongBufferChain& operator=(MahjongBufferChain&& stOther) noexcept;
+        ~MahjongBufferChain();
+
+        // 链中的总字节数
+        size_t GetSize() const { return m_nSize; }
+        bool IsEmpty() const { return m_nSize == 0; }
+
+        // 追加数据：拷贝到尾段剩余空间或新段
+        void Append(const void* pData, size_t nSize);
+        // 追加另一条链：共享其所有段
+        void Append(const MahjongBufferChain& stOther);
+        // 在头部插入协议头：只为头部分配一个新段，原有数据不移动
+        void Prepend(const void* pData, size_t nSize);
+        // 在头部插入另一条链：共享其所有段
+        void Prepend(const MahjongBufferChain& stOther);
+        // 取[nOffset, nOffset + nSize)的子链，与原链共享段
+        MahjongBufferChain Slice(size_t nOffset, size_t nSize) const;
+        // 丢弃头部nSize字节（writev发送后调用）
+        void Consume(size_t nSize);
+        // 拷贝出头部最多nSize字节，返回实际拷贝数
+        size_t CopyTo(void* pDest, size_t nSize) const;
+        void Clear();
+
+        // 填充可读数据的iovec数组供writev使用，返回填充的个数
+        size_t GetReadIovec(iovec* pstIovec, size_t nIovecNum) const;
+        // 预留至少nSize字节的可写空间并填充iovec数组供readv使用，返回填充的个数
+        size_t PrepareWriteIovec(size_t nSize, iovec* pstIovec, size_t nIovecNum);
+        // readv写入nSize字节后提交，未用到的预留段会被释放
+        void CommitWrite(size_t nSize);
+
+        // 从fd读取最多nSize字节追加到链尾，返回值同readv
+        ssize_t ReadFromFd(int nFd, size_t nSize);
+        // 把链中数据写入fd并丢弃已写部分，返回值同writev
+        ssize_t WriteToFd(int nFd);
+
+    private:
+        // 段中的一段连续数据
+        struct BufferSlice
+        {
+            MahjongBufferSegment* m_pstSegment;
+            uint32_t m_nOffset;
+            uint32_t m_nLength;
+        };
+
+        // 从堆中分配一个数据区容量为nCapacity的段
+        MahjongBufferSegment* NewSegment(size_t nCapacity);
+        static void AddRef(MahjongBufferSegment* pstSegment);
+        static void Release(MahjongBufferSegment* pstSegment);
+        // 尾段是否可以继续追加：独占且片段结尾就是段的写入位置
+        bool IsTailWritable() const;
+
+    private:
+        MahjongHeap* m_pstHeap;
+        size_t m_nSegmentSize;
+        size_t m_nSize;
+        std::vector<BufferSlice> m_vecSlice;
+        // PrepareWriteIovec预留的首个可写片段下标（可能是已有数据的尾片段），没有预留时等于m_vecSlice.size()
+        size_t m_nWriteSlice;
+    };
+}
@@ -1,16 +1,16 @@
+#include <algorithm>
 #include <cassert>
+#include <cstdint>
 #include <thread>
+#include <vector>
 #include "majhongcentralcache.h"
 #include "majhongpagecache.h"
 
 
 namespace MahjongMemoryPool 
 {
-    // 每个页缓存大小（单位：页）
-    static const size_t PAGECACHESIZE = 8;
-
     // 从中央缓存获取指定范围的内存块
-    void* MahjongCentralCache::GetCacheByRange(size_t nIndex, size_t nBatchNum)
+    void* MahjongCentralCache::GetCacheByRange(size_t nIndex, size_t nBatchNum, MahjongPageStash* pstStash)
     {
         // 参数有效性检查
         if (nIndex >= FREE_LIST_SIZE || nBatchNum == 0)
@@ -35,7 +35,7 @@ namespace MahjongMemoryPool
                 // 计算当前索引对应的内存块大小
                 size_t nSize = (nIndex + 1) * ALIGNMENT;
                 // 从页缓存获取新内存块
-                pstResult = GetCacheByPageCacheSize(nSize);
+                pstResult = GetCacheByPageCacheSize(nSize, pstStash);
                 if (!pstResult)
                 {
                     m_Locks[nIndex].clear(std::memory_order_release);  // 释放锁
@@ -44,22 +44,19 @@ namespace MahjongMemoryPool
 
                 // 将大块内存分割为小内存块并构建链表
                 char* pstStart = static_cast<char*>(pstResult);
-                size_t nTotalBlocks = (PAGECACHESIZE * MahjongPageCache::PAGESIZE) / nSize;  // 总可用块数
+                size_t nTotalBlocks = (GetSpanPageNum(nSize) * MahjongPageCache::PAGESIZE) / nSize;  // 总可用块数
                 size_t nAllocBlocks = std::min(nBatchNum, nTotalBlocks);  // 实际分配块数
 
-                if (nAllocBlocks > 1)  // 需要构建链表
+                // 构建分配块的链表（隐式链表，利用内存块头部存储下一节点指针）
+                for (size_t i = 1; i < nAllocBlocks; ++i)
                 {
-                    // 构建分配块的链表（隐式链表，利用内存块头部存储下一节点指针）
-                    for (size_t i = 1; i < nAllocBlocks; ++i)
-                    {
-                        void* pstCurrent = pstStart + (i - 1) * nSize;  // 当前块地址
-                        void* pstNext = pstStart + i * nSize;            // 下一块地址
-                        *reinterpret_cast<void**>(pstCurrent) = pstNext;  // 写入指针
-                    }
-
-                    *reinterpret_cast<void**>(pstStart + (nAllocBlocks - 1) * nSize) = nullptr;  // 链表结尾
+                    void* pstCurrent = pstStart + (i - 1) * nSize;  // 当前块地址
+                    void* pstNext = pstStart + i * nSize;            // 下一块地址
+                    *reinterpret_cast<void**>(pstCurrent) = pstNext;  // 写入指针
                 }
 
+                *reinterpret_cast<void**>(pstStart + (nAllocBlocks - 1) * nSize) = nullptr;  // 链表结尾
+
                 // 处理剩余未分配的内存块
                 if (nTotalBlocks > nAllocBlocks)
                 {
@@ -76,6 +73,7 @@ namespace MahjongMemoryPool
                     // 存储剩余链表到中央空闲列表（内存序：释放语义保证可见性）
                     m_CentralFreeList[nIndex].store(pstRemainStart, std::memory_order_release);
                 }
+                AddUseNum(nIndex, nAllocBlocks);
             }
             else  // 当前链表有可用内存
             {
@@ -98,6 +96,7 @@ namespace MahjongMemoryPool
                 }
                 // 更新中央空闲链表头（注意：原代码拼写错误应为release）
                 m_CentralFreeList[nIndex].store(pstCurrent, std::memory_order_release);
+                AddUseNum(nIndex, nCount);
             }
         }
         catch (...)  // 异常处理
@@ -111,7 +110,7 @@ namespace MahjongMemoryPool
     }
 
     // 将内存块归还到中央缓存
-    void MahjongCentralCache::SetCacheByRange(void* pstStart, size_t nSize, size_t nIndex)
+    void MahjongCentralCache::SetCacheByRange(void* pstStart, size_t nBlockNum, size_t nIndex)
     {
         // 参数检查
         if (!pstStart || nIndex >= FREE_LIST_SIZE)
@@ -131,7 +130,7 @@ namespace MahjongMemoryPool
             size_t nCount = 1;        // 计数
 
             // 查找链表末尾
-            while (*reinterpret_cast<void**>(pstEnd) != nullptr && nCount < nSize)
+            while (*reinterpret_cast<void**>(pstEnd) != nullptr && nCount < nBlockNum)
             {
                 pstEnd = *reinterpret_cast<void**>(pstEnd);  // 移动到下一节点
                 nCount++;
@@ -141,6 +140,8 @@ namespace MahjongMemoryPool
             void* pstCurrent = m_CentralFreeList[nIndex].load(std::memory_order_relaxed);
             *reinterpret_cast<void**>(pstEnd) = pstCurrent;   // 原链表头接到新链表尾
             m_CentralFreeList[nIndex].store(pstStart, std::memory_order_release);  // 更新链表头
+            m_UseNum[nIndex] -= std::min(m_UseNum[nIndex], nCount);
+            SetReturned(nIndex);
         }
         catch (...)
         {
@@ -152,21 +153,277 @@ namespace MahjongMemoryPool
     }
 
     // 从页缓存获取内存块
-    void* MahjongCentralCache::GetCacheByPageCacheSize(size_t nSize)
+    void* MahjongCentralCache::GetCacheByPageCacheSize(size_t nSize, MahjongPageStash* pstStash)
     {
-        // 计算需要的页数（向上取整）
-        size_t nPageNum = (nSize + MahjongPageCache::PAGESIZE - 1) / MahjongPageCache::PAGESIZE;
+        // 固定页数的页缓存块，单个对象超过该大小时按需分配页数；固定页数的span优先从线程页暂存区获取
+        // 分配时一并记录span的切分大小，供按指针查询可用大小
+        size_t nPageNum = GetSpanPageNum(nSize);
+        if (pstStash != nullptr && nPageNum == m_pstConfig->m_nSpanPageNum)
+        {
+            return m_pstPageCache->NewCacheByStash(*pstStash, nPageNum, m_pstConfig->m_nPageStashNum, nSize);
+        }
+        return m_pstPageCache->NewCacheByPageNum(nPageNum, 0, nSize);
+    }
 
-        // 根据大小选择分配策略
-        if (nSize <= PAGECACHESIZE * MahjongPageCache::PAGESIZE)
+    // 计算指定大小的内存块所用span的页数
+    size_t MahjongCentralCache::GetSpanPageNum(size_t nSize) const
+    {
+        return std::max(m_pstConfig->m_nSpanPageNum, MahjongPageCache::GetPageNumBySize(nSize));
+    }
+
+    // 清空所有自由链表
+    void MahjongCentralCache::ReleaseAllCache()
+    {
+        for (size_t nIndex = 0; nIndex < FREE_LIST_SIZE; ++nIndex)
         {
-            // 分配固定大小的页缓存块（注意：函数名疑似拼写错误应为GetCacheByPageNum）
-            return MahjongPageCache::GetInstance().NewCacheByPageNum(PAGECACHESIZE);
+            while (m_Locks[nIndex].test_and_set(std::memory_order_acquire))
+            {
+                std::this_thread::yield();
+            }
+
+            m_CentralFreeList[nIndex].store(nullptr, std::memory_order_release);
+            m_UseNum[nIndex] = 0;
+            m_PeakUseNum[nIndex] = 0;
+            m_Locks[nIndex].clear(std::memory_order_release);
         }
-        else
+    }
+
+    // 预热：把指定尺寸类的中心自由链表填充到至少nBlockNum块
+    size_t MahjongCentralCache::PrewarmCacheByIndex(size_t nIndex, size_t nBlockNum, size_t& nPageBudget)
+    {
+        if (nIndex >= FREE_LIST_SIZE || nBlockNum == 0)
+        {
+            return 0;
+        }
+
+        size_t nSize = (nIndex + 1) * ALIGNMENT;
+        size_t nSpanPageNum = GetSpanPageNum(nSize);
+        size_t nTotalBlocks = (nSpanPageNum * MahjongPageCache::PAGESIZE) / nSize;  // 每个span的块数
+
+        while (m_Locks[nIndex].test_and_set(std::memory_order_acquire))
+        {
+            std::this_thread::yield();
+        }
+
+        // 已有的空闲块计入目标
+        size_t nFreeNum = 0;
+        for (void* pstNode = m_CentralFreeList[nIndex].load(std::memory_order_relaxed);
+            pstNode != nullptr && nFreeNum < nBlockNum;
+            pstNode = *reinterpret_cast<void**>(pstNode))
+        {
+            nFreeNum++;
+        }
+
+        size_t nNewNum = 0;
+        while (nFreeNum + nNewNum < nBlockNum && nPageBudget >= nSpanPageNum)
         {
-            // 按需分配页数
-            return MahjongPageCache::GetInstance().NewCacheByPageNum(nPageNum);
+            char* pstStart = static_cast<char*>(GetCacheByPageCacheSize(nSize));
+            if (pstStart == nullptr)
+            {
+                break;  // 页缓存分配失败，能预热多少算多少
+            }
+            nPageBudget -= nSpanPageNum;
+
+            // 整个span切分后挂到中心自由链表头部
+            for (size_t i = 1; i < nTotalBlocks; ++i)
+            {
+                *reinterpret_cast<void**>(pstStart + (i - 1) * nSize) = pstStart + i * nSize;
+            }
+            *reinterpret_cast<void**>(pstStart + (nTotalBlocks - 1) * nSize) = m_CentralFreeList[nIndex].load(std::memory_order_relaxed);
+            m_CentralFreeList[nIndex].store(pstStart, std::memory_order_release);
+            SetReturned(nIndex);
+            nNewNum += nTotalBlocks;
+        }
+
+        m_Locks[nIndex].clear(std::memory_order_release);
+        return nNewNum;
+    }
+
+    // 预热指定块数需要的页数
+    size_t MahjongCentralCache::GetPrewarmPageNum(size_t nIndex, size_t nBlockNum) const
+    {
+        size_t nSize = (nIndex + 1) * ALIGNMENT;
+        size_t nSpanPageNum = GetSpanPageNum(nSize);
+        size_t nTotalBlocks = (nSpanPageNum * MahjongPageCache::PAGESIZE) / nSize;
+        // 先除后补余数，块数接近size_t上限时不会溢出
+        size_t nSpanNum = nBlockNum / nTotalBlocks + (nBlockNum % nTotalBlocks != 0 ? 1 : 0);
+        return nSpanNum > SIZE_MAX / nSpanPageNum ? SIZE_MAX : nSpanNum * nSpanPageNum;
+    }
+
+    // 尺寸类历史最多同时被线程缓存取走的块数
+    size_t MahjongCentralCache::GetPeakUseNum(size_t nIndex)
+    {
+        while (m_Locks[nIndex].test_and_set(std::memory_order_acquire))
+        {
+            std::this_thread::yield();
+        }
+
+        size_t nPeakUseNum = m_PeakUseNum[nIndex];
+        m_Locks[nIndex].clear(std::memory_order_release);
+        return nPeakUseNum;
+    }
+
+    // 把自由链表中所有块都空闲的span归还页缓存
+    size_t MahjongCentralCache::ReleaseFreeSpan()
+    {
+        size_t nReleasePageNum = 0;
+        std::vector<void*> vecBlock;
+        for (size_t nWord = 0; nWord < m_ReturnMask.size(); ++nWord)
+        {
+            // 先读后取，大多数尺寸类没有新块，不必逐个加锁检查
+            if (m_ReturnMask[nWord].load(std::memory_order_relaxed) == 0)
+            {
+                continue;
+            }
+
+            // 取走后新加入的块会重新置位，留给下一次清空
+            uint64_t nMask = m_ReturnMask[nWord].exchange(0, std::memory_order_acquire);
+            while (nMask != 0)
+            {
+                size_t nIndex = nWord * 64 + static_cast<size_t>(__builtin_ctzll(nMask));
+                nMask &= nMask - 1;
+                nReleasePageNum += ReleaseFreeSpanByIndex(nIndex, vecBlock);
+            }
+        }
+        return nReleasePageNum;
+    }
+
+    // 归还单个尺寸类中所有块都空闲的span
+    size_t MahjongCentralCache::ReleaseFreeSpanByIndex(size_t nIndex, std::vector<void*>& vecBlock)
+    {
+        // 一次只锁一个尺寸类，不影响其他尺寸类的分配
+        while (m_Locks[nIndex].test_and_set(std::memory_order_acquire))
+        {
+            std::this_thread::yield();
         }
+
+        void* pstHead = m_CentralFreeList[nIndex].load(std::memory_order_relaxed);
+        if (pstHead == nullptr)
+        {
+            m_Locks[nIndex].clear(std::memory_order_release);
+            return 0;
+        }
+
+        size_t nReleasePageNum = 0;
+
+        // 按地址排序后同一span的块相邻，逐个span统计空闲块数
+        vecBlock.clear();
+        for (void* pstNode = pstHead; pstNode != nullptr; pstNode = *reinterpret_cast<void**>(pstNode))
+        {
+            vecBlock.push_back(pstNode);
+        }
+        std::sort(vecBlock.begin(), vecBlock.end());
+
+        size_t nSize = (nIndex + 1) * ALIGNMENT;
+        size_t nKeepNum = 0;
+        for (size_t i = 0; i < vecBlock.size();)
+        {
+            void* pstSpanAddr = nullptr;
+            size_t nPageNum = 0;
+            if (!m_pstPageCache->GetSpanByAddr(vecBlock[i], pstSpanAddr, nPageNum))
+            {
+                vecBlock[nKeepNum++] = vecBlock[i++];
+                continue;
+            }
+
+            char* pstSpanEnd = static_cast<char*>(pstSpanAddr) + nPageNum * MahjongPageCache::PAGESIZE;
+            size_t j = i;
+            while (j < vecBlock.size() && static_cast<char*>(vecBlock[j]) < pstSpanEnd)
+            {
+                j++;
+            }
+
+            if (j - i == nPageNum * MahjongPageCache::PAGESIZE / nSize)
+            {
+                // span切出的块全部在链表中，整个span归还页缓存
+                m_pstPageCache->DeleteCacheByPageNum(pstSpanAddr, nPageNum);
+                nReleasePageNum += nPageNum;
+            }
+            else
+            {
+                while (i < j)
+                {
+                    vecBlock[nKeepNum++] = vecBlock[i++];
+                }
+            }
+            i = j;
+        }
+
+        // 剩余的块按地址顺序重新串成链表
+        void* pstNewHead = nullptr;
+        for (size_t i = nKeepNum; i > 0; --i)
+        {
+            *reinterpret_cast<void**>(vecBlock[i - 1]) = pstNewHead;
+            pstNewHead = vecBlock[i - 1];
+        }
+        m_CentralFreeList[nIndex].store(pstNewHead, std::memory_order_release);
+        m_Locks[nIndex].clear(std::memory_order_release);
+        return nReleasePageNum;
+    }
+
+    // 复制指定尺寸类中心自由链表中的全部块地址
+    void MahjongCentralCache::GetFreeCacheByIndex(size_t nIndex, std::vector<void*>& vecBlock)
+    {
+        vecBlock.clear();
+        if (nIndex >= FREE_LIST_SIZE)
+        {
+            return;
+        }
+
+        while (m_Locks[nIndex].test_and_set(std::memory_order_acquire))
+        {
+            std::this_thread::yield();
+        }
+
+        for (void* pstNode = m_CentralFreeList[nIndex].load(std::memory_order_relaxed); pstNode != nullptr;
+            pstNode = *reinterpret_cast<void**>(pstNode))
+        {
+            vecBlock.push_back(pstNode);
+        }
+
+        m_Locks[nIndex].clear(std::memory_order_release);
+    }
+
+    // 读取尺寸类的自由链表头
+    void* MahjongCentralCache::GetFreeListHead(size_t nIndex)
+    {
+        while (m_Locks[nIndex].test_and_set(std::memory_order_acquire))
+        {
+            std::this_thread::yield();
+        }
+
+        void* pstHead = m_CentralFreeList[nIndex].load(std::memory_order_relaxed);
+        m_Locks[nIndex].clear(std::memory_order_release);
+        return pstHead;
+    }
+
+    // 设置尺寸类的自由链表头
+    void MahjongCentralCache::SetFreeListHead(size_t nIndex, void* pstHead)
+    {
+        while (m_Locks[nIndex].test_and_set(std::memory_order_acquire))
+        {
+            std::this_thread::yield();
+        }
+
+        m_CentralFreeList[nIndex].store(pstHead, std::memory_order_release);
+        SetReturned(nIndex);
+        m_Locks[nIndex].clear(std::memory_order_release);
+    }
+
+    // 标记尺寸类有块加入自由链表，已标记时只读不写，避免各线程反复写同一缓存行（调用方持有尺寸类的锁）
+    void MahjongCentralCache::SetReturned(size_t nIndex)
+    {
+        uint64_t nBit = uint64_t(1) << (nIndex % 64);
+        if ((m_ReturnMask[nIndex / 64].load(std::memory_order_relaxed) & nBit) == 0)
+        {
+            m_ReturnMask[nIndex / 64].fetch_or(nBit, std::memory_order_release);
+        }
+    }
+
+    // 记录取走的块数并更新峰值（调用方持有尺寸类的锁）
+    void MahjongCentralCache::AddUseNum(size_t nIndex, size_t nBlockNum)
+    {
+        m_UseNum[nIndex] += nBlockNum;
+        m_PeakUseNum[nIndex] = std::max(m_PeakUseNum[nIndex], m_UseNum[nIndex]);
     }
-}
+}
\ No newline at end of file
@@ -7,23 +7,20 @@
 #pragma once
 #include "common.h"
 #include <mutex>
+#include <vector>
 
 namespace MahjongMemoryPool 
 {
+    class MahjongPageCache;
+    struct MahjongPageStash;
+
 	class MahjongCentralCache
 	{
 	public:
-		static MahjongCentralCache& GetInstance() 
-        {
-			static MahjongCentralCache stCentralCacheInstance;
-			return stCentralCacheInstance;
-		}
-
-		void* GetCacheByRange(size_t nIndex, size_t nBatchNum);
-		void SetCacheByRange(void* pstStart, size_t nSize, size_t nIndex);
-	private:
         // 相互是还所有原子指针为nullptr
-		MahjongCentralCache() 
+		MahjongCentralCache(MahjongPageCache* pstPageCache, const MahjongHeapConfig* pstConfig)
+            : m_pstPageCache(pstPageCache)
+            , m_pstConfig(pstConfig)
 		{
 			// 初始化中心缓存的自由链表
 			for (auto& ptr : m_CentralFreeList)
@@ -36,16 +33,61 @@ namespace MahjongMemoryPool
 			{
 				lock.clear();
 			}
+
+            m_UseNum.fill(0);
+            m_PeakUseNum.fill(0);
+            for (auto& nMask : m_ReturnMask)
+            {
+                nMask.store(0, std::memory_order_relaxed);
+            }
 		}
 
+        // pstStash为调用线程的页暂存区，补充span时优先从中获取
+		void* GetCacheByRange(size_t nIndex, size_t nBatchNum, MahjongPageStash* pstStash = nullptr);
+		void SetCacheByRange(void* pstStart, size_t nBlockNum, size_t nIndex);
+        // 清空所有自由链表（所属页缓存整体释放时调用）
+        void ReleaseAllCache();
+        // 预热：把指定尺寸类的中心自由链表填充到至少nBlockNum块，返回新切分的块数
+        // nPageBudget为剩余可映射的页数，每切分一个span扣除其页数，不足一个span时停止
+        size_t PrewarmCacheByIndex(size_t nIndex, size_t nBlockNum, size_t& nPageBudget);
+        // 预热指定块数需要的页数
+        size_t GetPrewarmPageNum(size_t nIndex, size_t nBlockNum) const;
+        // 尺寸类历史最多同时被线程缓存取走的块数（工作集）
+        size_t GetPeakUseNum(size_t nIndex);
+        // 把自由链表中所有块都空闲的span归还页缓存，返回归还的页数
+        size_t ReleaseFreeSpan();
+        // 复制指定尺寸类中心自由链表中的全部块地址（只在复制期间加锁）
+        void GetFreeCacheByIndex(size_t nIndex, std::vector<void*>& vecBlock);
+        // 读取/设置尺寸类的自由链表头，持久化堆退出和重新挂载时使用
+        void* GetFreeListHead(size_t nIndex);
+        void SetFreeListHead(size_t nIndex, void* pstHead);
+	private:
         // 从页缓存获取内存
-		void* GetCacheByPageCacheSize(size_t nSize);
+		void* GetCacheByPageCacheSize(size_t nSize, MahjongPageStash* pstStash = nullptr);
+        // 计算指定大小的内存块所用span的页数
+        size_t GetSpanPageNum(size_t nSize) const;
+        // 记录取走的块数并更新峰值（调用方持有尺寸类的锁）
+        void AddUseNum(size_t nIndex, size_t nBlockNum);
+        // 标记尺寸类有块加入自由链表
+        void SetReturned(size_t nIndex);
+        // 归还单个尺寸类中所有块都空闲的span（调用方不持有锁）
+        size_t ReleaseFreeSpanByIndex(size_t nIndex, std::vector<void*>& vecBlock);
 
     private:
+        // 所属堆的页缓存与配置
+        MahjongPageCache* m_pstPageCache;
+        const MahjongHeapConfig* m_pstConfig;
+
         // 中心缓存的自由链表
 		std::array<std::atomic<void*>, FREE_LIST_SIZE> m_CentralFreeList;
 
         // 用于同步的自旋锁
 		std::array<std::atomic_flag, FREE_LIST_SIZE> m_Locks;
+
+        // 各尺寸类当前被线程缓存取走的块数及其峰值，受对应自旋锁保护
+        std::array<size_t, FREE_LIST_SIZE> m_UseNum;
+        std::array<size_t, FREE_LIST_SIZE> m_PeakUseNum;
+        // 上次ReleaseFreeSpan之后有块加入自由链表的尺寸类（每位一个尺寸类），没有新块的尺寸类不会凑出完整span，清空时跳过
+        std::array<std::atomic<uint64_t>, (FREE_LIST_SIZE + 63) / 64> m_ReturnMask;
 	};
 }
\ No newline at end of file
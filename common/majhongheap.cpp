@@ -0,0 +1,588 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <unordered_map>
+#include "majhongheap.h"
+
+namespace MahjongMemoryPool
+{
+    namespace
+    {
+        std::atomic<uint64_t> g_nNextHeapId{ 1 };
+
+        // 存活堆登记表，线程退出时据此判断线程缓存所属的堆是否还在
+        // 使用不析构的静态对象，避免线程退出晚于静态析构时访问失效对象
+        std::mutex& GetHeapRegistryLock()
+        {
+            static std::mutex* pstLock = new std::mutex;
+            return *pstLock;
+        }
+
+        std::unordered_map<uint64_t, MahjongHeap*>& GetHeapRegistry()
+        {
+            static auto* pstRegistry = new std::unordered_map<uint64_t, MahjongHeap*>;
+            return *pstRegistry;
+        }
+
+        uint64_t RegisterHeap(MahjongHeap* pstHeap)
+        {
+            uint64_t nHeapId = g_nNextHeapId.fetch_add(1, std::memory_order_relaxed);
+            std::lock_guard<std::mutex> lock(GetHeapRegistryLock());
+            GetHeapRegistry()[nHeapId] = pstHeap;
+            return nHeapId;
+        }
+
+        void UnregisterHeap(uint64_t nHeapId)
+        {
+            std::lock_guard<std::mutex> lock(GetHeapRegistryLock());
+            GetHeapRegistry().erase(nHeapId);
+        }
+
+        // 每个线程持有的线程缓存表：堆编号 -> 该线程在此堆上的线程缓存
+        struct MahjongThreadCacheTable
+        {
+            uint64_t m_nLastHeapId = 0;
+            MahjongThreadCache* m_pstLastThreadCache = nullptr;
+            std::unordered_map<uint64_t, MahjongThreadCache*> m_mapThreadCache;
+
+            // 删除编号已注销的堆的表项，对应的线程缓存已随堆析构或Destroy释放
+            void PruneThreadCache()
+            {
+                std::lock_guard<std::mutex> lock(GetHeapRegistryLock());
+                for (auto it = m_mapThreadCache.begin(); it != m_mapThreadCache.end();)
+                {
+                    if (GetHeapRegistry().count(it->first) == 0)
+                    {
+                        if (it->first == m_nLastHeapId)
+                        {
+                            m_nLastHeapId = 0;
+                            m_pstLastThreadCache = nullptr;
+                        }
+                        it = m_mapThreadCache.erase(it);
+                    }
+                    else
+                    {
+                        ++it;
+                    }
+                }
+            }
+
+            // 线程退出时把缓存的块还给仍然存活的堆
+            ~MahjongThreadCacheTable()
+            {
+                std::lock_guard<std::mutex> lock(GetHeapRegistryLock());
+                for (auto& stEntry : m_mapThreadCache)
+                {
+                    auto it = GetHeapRegistry().find(stEntry.first);
+                    if (it != GetHeapRegistry().end())
+                    {
+                        it->second->ReleaseThreadCache(stEntry.second);
+                    }
+                }
+            }
+        };
+
+        thread_local MahjongThreadCacheTable t_stThreadCacheTable;
+    }
+
+    MahjongHeap::MahjongHeap(const MahjongHeapConfig& stConfig)
+        : m_stConfig(stConfig)
+        , m_pstPageCache(new MahjongPageCache(&m_stConfig))
+        , m_pstCentralCache(new MahjongCentralCache(m_pstPageCache.get(), &m_stConfig))
+        , m_nHeapId(RegisterHeap(this))
+    {
+        if (!m_stConfig.m_strPersistentName.empty()
+            && m_pstPageCache->AttachPersistentSegment(m_stConfig.m_strPersistentName,
+                m_stConfig.m_nPersistentAddr, m_stConfig.m_nPersistentSize))
+        {
+            LoadPersistentFreeList();
+        }
+    }
+
+    MahjongHeap::~MahjongHeap()
+    {
+        WaitPrewarm();
+        // 持久化堆的空闲块留在段内，重新挂载后要能继续使用
+        if (IsPersistent())
+        {
+            SavePersistentFreeList();
+        }
+        // 页缓存析构时把内存归还系统，持久化段则只断开映射
+        ReleaseAllThreadCache();
+    }
+
+    MahjongHeap& MahjongHeap::GetDefaultHeap()
+    {
+        static MahjongHeap* pstDefaultHeap = new MahjongHeap();
+        return *pstDefaultHeap;
+    }
+
+    // 获取当前线程在本堆上的线程缓存
+    MahjongThreadCache* MahjongHeap::GetThreadCache()
+    {
+        uint64_t nHeapId = m_nHeapId.load(std::memory_order_relaxed);
+        MahjongThreadCacheTable& stTable = t_stThreadCacheTable;
+
+        // 绝大多数线程只用一个堆，先比较上次命中的堆
+        if (stTable.m_nLastHeapId == nHeapId)
+        {
+            return stTable.m_pstLastThreadCache;
+        }
+
+        auto it = stTable.m_mapThreadCache.find(nHeapId);
+        if (it == stTable.m_mapThreadCache.end())
+        {
+            // 新增表项前清理已析构或已Destroy的堆，堆反复创建销毁时表不会无限增长
+            stTable.PruneThreadCache();
+            it = stTable.m_mapThreadCache.emplace(nHeapId, nullptr).first;
+        }
+
+        MahjongThreadCache*& pstThreadCache = it->second;
+        if (pstThreadCache == nullptr)
+        {
+            pstThreadCache = new MahjongThreadCache(this);
+            std::lock_guard<std::mutex> lock(m_MutexLock);
+            m_vecThreadCache.push_back(pstThreadCache);
+        }
+
+        stTable.m_nLastHeapId = nHeapId;
+        stTable.m_pstLastThreadCache = pstThreadCache;
+        return pstThreadCache;
+    }
+
+    // 当前线程的线程缓存表项数
+    size_t MahjongHeap::GetThreadCacheTableSize()
+    {
+        return t_stThreadCacheTable.m_mapThreadCache.size();
+    }
+
+    // 回收某个线程在本堆上的线程缓存
+    void MahjongHeap::ReleaseThreadCache(MahjongThreadCache* pstThreadCache)
+    {
+        std::lock_guard<std::mutex> lock(m_MutexLock);
+
+        auto it = std::find(m_vecThreadCache.begin(), m_vecThreadCache.end(), pstThreadCache);
+        if (it == m_vecThreadCache.end())
+        {
+            return;  // 已随Destroy释放
+        }
+
+        pstThreadCache->ReleaseAllCache();
+        delete pstThreadCache;
+        m_vecThreadCache.erase(it);
+    }
+
+    // 一次性释放本堆持有的全部内存
+    void MahjongHeap::Destroy()
+    {
+        WaitPrewarm();
+        ReleaseAllCache();
+        m_nHeapId.store(RegisterHeap(this), std::memory_order_relaxed);
+    }
+
+    // 清空各级缓存并把空闲内存归还系统
+    size_t MahjongHeap::ReleaseFreeMemory()
+    {
+        // 先通知其他线程，再归还当前线程的缓存
+        m_nFlushEpoch.fetch_add(1, std::memory_order_relaxed);
+        GetThreadCache()->ReleaseAllCache();
+
+        m_pstCentralCache->ReleaseFreeSpan();
+        return m_pstPageCache->ReleaseFreeCache();
+    }
+
+    // 处理页缓存标记的内存压力
+    void MahjongHeap::CheckMemoryPressure()
+    {
+        if (!m_pstPageCache->HasMemoryPressure())
+        {
+            return;
+        }
+
+        // 先取得处理权再清除页缓存的标记：已有线程在处理时标记保留，由之后的调用处理
+        if (m_bMemoryPressure.exchange(true, std::memory_order_acquire))
+        {
+            return;
+        }
+        if (!m_pstPageCache->ClearMemoryPressure())
+        {
+            m_bMemoryPressure.store(false, std::memory_order_release);
+            return;
+        }
+
+        try
+        {
+            ReleaseFreeMemory();
+            if (m_stConfig.m_fnSoftLimitCallback)
+            {
+                m_stConfig.m_fnSoftLimitCallback(GetSystemCacheSize());
+            }
+        }
+        catch (...)
+        {
+            m_bMemoryPressure.store(false, std::memory_order_release);
+            throw;
+        }
+
+        m_bMemoryPressure.store(false, std::memory_order_release);
+    }
+
+    // 达到硬上限分配失败时清空缓存
+    void MahjongHeap::ReleaseFreeMemoryByHardLimit()
+    {
+        // 本线程缓存和页暂存区中的空闲块只有本线程能归还，即使其他线程正在处理软上限也要先归还
+        m_nFlushEpoch.fetch_add(1, std::memory_order_relaxed);
+        GetThreadCache()->ReleaseAllCache();
+
+        // 归还时正在进行的清空可能已经错过这些块，之后完整开始的一次清空（完成次数至少加2）才能代替本线程清空
+        uint64_t nDrainNum = m_nHardLimitDrainNum.load(std::memory_order_acquire);
+        std::lock_guard<std::mutex> lock(m_HardLimitLock);
+        if (m_nHardLimitDrainNum.load(std::memory_order_relaxed) >= nDrainNum + 2)
+        {
+            return;
+        }
+
+        m_pstCentralCache->ReleaseFreeSpan();
+        m_pstPageCache->ReleaseFreeCache();
+        m_nHardLimitDrainNum.fetch_add(1, std::memory_order_release);
+    }
+
+    // 遍历所有span生成碎片与占用报告
+    MahjongHeapReport MahjongHeap::GetReport()
+    {
+        const size_t PAGESIZE = MahjongPageCache::PAGESIZE;
+        MahjongHeapReport stReport;
+        stReport.m_nSystemCacheSize = GetSystemCacheSize();
+
+        // 页缓存：大对象取整浪费、空闲span分布和地址连续的最长空闲页
+        std::vector<MahjongSpanInfo> vecSpan = m_pstPageCache->GetSpanInfo();
+        std::map<size_t, std::vector<const MahjongSpanInfo*>> mapClassSpan;
+        size_t nFreeRunPageNum = 0;
+        char* pstFreeRunEnd = nullptr;
+        for (const MahjongSpanInfo& stSpan : vecSpan)
+        {
+            size_t nSpanSize = stSpan.m_nPageNum * PAGESIZE;
+            if (!stSpan.m_bInUse)
+            {
+                size_t nBucket = 0;
+                while ((size_t(2) << nBucket) <= stSpan.m_nPageNum)
+                {
+                    nBucket++;
+                }
+                if (stReport.m_vecFreeRun.size() <= nBucket)
+                {
+                    stReport.m_vecFreeRun.resize(nBucket + 1, 0);
+                }
+                stReport.m_vecFreeRun[nBucket]++;
+                stReport.m_nFreePageNum += stSpan.m_nPageNum;
+
+                nFreeRunPageNum = stSpan.m_pstAddr == pstFreeRunEnd ? nFreeRunPageNum + stSpan.m_nPageNum : stSpan.m_nPageNum;
+                pstFreeRunEnd = static_cast<char*>(stSpan.m_pstAddr) + nSpanSize;
+                stReport.m_nLargestFreeRunPageNum = std::max(stReport.m_nLargestFreeRunPageNum, nFreeRunPageNum);
+            }
+            else if (stSpan.m_bStash)
+            {
+                stReport.m_nThreadStashSize += nSpanSize;
+            }
+            else if (stSpan.m_nObjectSize == 0)
+            {
+                stReport.m_nLargeSpanSize += nSpanSize;
+                if (stSpan.m_nRequestSize != 0 && stSpan.m_nRequestSize <= nSpanSize)
+                {
+                    stReport.m_nLargeWasteSize += nSpanSize - stSpan.m_nRequestSize;
+                }
+            }
+            else
+            {
+                stReport.m_nSmallSpanSize += nSpanSize;
+                mapClassSpan[stSpan.m_nObjectSize].push_back(&stSpan);
+            }
+        }
+
+        // 小对象：逐个尺寸类复制中心自由链表，按地址统计每个span中的空闲块
+        std::vector<void*> vecBlock;
+        for (auto& stClassSpan : mapClassSpan)
+        {
+            MahjongSizeClassReport stClass;
+            stClass.m_nObjectSize = stClassSpan.first;
+            stClass.m_nSpanNum = stClassSpan.second.size();
+
+            m_pstCentralCache->GetFreeCacheByIndex(MahJongSizeClass::GetIndex(stClass.m_nObjectSize), vecBlock);
+            std::sort(vecBlock.begin(), vecBlock.end());
+            stReport.m_nCentralFreeSize += vecBlock.size() * stClass.m_nObjectSize;
+
+            for (const MahjongSpanInfo* pstSpan : stClassSpan.second)
+            {
+                size_t nSpanSize = pstSpan->m_nPageNum * PAGESIZE;
+                size_t nBlockNum = nSpanSize / stClass.m_nObjectSize;
+                char* pstSpanStart = static_cast<char*>(pstSpan->m_pstAddr);
+                size_t nFreeNum = std::lower_bound(vecBlock.begin(), vecBlock.end(), pstSpanStart + nSpanSize)
+                    - std::lower_bound(vecBlock.begin(), vecBlock.end(), pstSpanStart);
+                nFreeNum = std::min(nFreeNum, nBlockNum);
+
+                size_t nBucket = (nBlockNum - nFreeNum) * MahjongSizeClassReport::OCCUPANCYBUCKETNUM / nBlockNum;
+                stClass.m_arrOccupancy[std::min(nBucket, MahjongSizeClassReport::OCCUPANCYBUCKETNUM - 1)]++;
+                stClass.m_nBlockNum += nBlockNum;
+                stClass.m_nCentralFreeNum += nFreeNum;
+                stClass.m_nTailWasteSize += nSpanSize - nBlockNum * stClass.m_nObjectSize;
+            }
+
+            stReport.m_nTailWasteSize += stClass.m_nTailWasteSize;
+            stReport.m_vecSizeClass.push_back(stClass);
+        }
+
+        // 线程缓存只读取各自维护的空闲字节数，不访问其自由链表
+        std::lock_guard<std::mutex> lock(m_MutexLock);
+        for (MahjongThreadCache* pstThreadCache : m_vecThreadCache)
+        {
+            stReport.m_nThreadCacheSize += pstThreadCache->GetFreeCacheSize();
+        }
+        return stReport;
+    }
+
+    // 采集当前各尺寸类的工作集画像
+    MahjongHeapProfile MahjongHeap::GetProfile()
+    {
+        MahjongHeapProfile vecProfile;
+        for (size_t nIndex = 0; nIndex < FREE_LIST_SIZE; ++nIndex)
+        {
+            size_t nPeakUseNum = m_pstCentralCache->GetPeakUseNum(nIndex);
+            if (nPeakUseNum > 0)
+            {
+                vecProfile.emplace_back((nIndex + 1) * ALIGNMENT, nPeakUseNum);
+            }
+        }
+        return vecProfile;
+    }
+
+    // 把工作集画像保存到文件
+    bool MahjongHeap::SaveProfile(const std::string& strPath)
+    {
+        std::ofstream stFile(strPath, std::ios::trunc);
+        if (!stFile)
+        {
+            return false;
+        }
+
+        stFile << "# MahjongHeap profile: <block size> <block num>\n";
+        for (const auto& stEntry : GetProfile())
+        {
+            stFile << stEntry.first << ' ' << stEntry.second << '\n';
+        }
+        return static_cast<bool>(stFile);
+    }
+
+    // 从文件读取工作集画像
+    bool MahjongHeap::LoadProfile(const std::string& strPath, MahjongHeapProfile& vecProfile)
+    {
+        std::ifstream stFile(strPath);
+        if (!stFile)
+        {
+            return false;
+        }
+
+        vecProfile.clear();
+        size_t nTotalSize = 0;
+        std::string strLine;
+        while (std::getline(stFile, strLine))
+        {
+            if (strLine.empty() || strLine[0] == '#')
+            {
+                continue;
+            }
+
+            size_t nSize = 0;
+            size_t nBlockNum = 0;
+            if (sscanf(strLine.c_str(), "%zu %zu", &nSize, &nBlockNum) != 2 || nSize == 0 || nSize > MAX_BYTES)
+            {
+                return false;  // 格式错误的画像整体丢弃
+            }
+
+            // 块数超过预热上限的画像同样丢弃，先按单行判断避免乘法溢出
+            if (nBlockNum > MAXPREWARMSIZE / nSize || nSize * nBlockNum > MAXPREWARMSIZE - nTotalSize)
+            {
+                return false;
+            }
+            nTotalSize += nSize * nBlockNum;
+            vecProfile.emplace_back(nSize, nBlockNum);
+        }
+        return true;
+    }
+
+    // 按画像预热中心缓存
+    void MahjongHeap::Prewarm(const MahjongHeapProfile& vecProfile)
+    {
+        // 预热总页数不超过MAXPREWARMSIZE，设置了硬上限时也不超过硬上限
+        size_t nMaxPageNum = MAXPREWARMSIZE / MahjongPageCache::PAGESIZE;
+        if (m_stConfig.m_nHardLimit != 0)
+        {
+            nMaxPageNum = std::min(nMaxPageNum, m_stConfig.m_nHardLimit / MahjongPageCache::PAGESIZE);
+        }
+
+        // 先算出总页数一次性映射，避免逐个span触发mmap
+        size_t nTotalPageNum = 0;
+        for (const auto& stEntry : vecProfile)
+        {
+            size_t nPageNum = m_pstCentralCache->GetPrewarmPageNum(MahJongSizeClass::GetIndex(stEntry.first), stEntry.second);
+            nTotalPageNum += std::min(nPageNum, nMaxPageNum - nTotalPageNum);
+        }
+        m_pstPageCache->ReserveCacheByPageNum(nTotalPageNum);
+
+        size_t nPageBudget = nMaxPageNum;
+        for (const auto& stEntry : vecProfile)
+        {
+            m_pstCentralCache->PrewarmCacheByIndex(MahJongSizeClass::GetIndex(stEntry.first), stEntry.second, nPageBudget);
+        }
+    }
+
+    // 读取画像文件并预热
+    bool MahjongHeap::PrewarmByProfile(const std::string& strPath, bool bAsync)
+    {
+        MahjongHeapProfile vecProfile;
+        if (!LoadProfile(strPath, vecProfile))
+        {
+            return false;
+        }
+
+        if (!bAsync)
+        {
+            Prewarm(vecProfile);
+            return true;
+        }
+
+        WaitPrewarm();
+        m_PrewarmThread = std::thread([this, vecProfile]()
+        {
+            Prewarm(vecProfile);
+        });
+        return true;
+    }
+
+    // 等待后台预热结束
+    void MahjongHeap::WaitPrewarm()
+    {
+        if (m_PrewarmThread.joinable())
+        {
+            m_PrewarmThread.join();
+        }
+    }
+
+    // 登记根对象
+    bool MahjongHeap::SetRoot(const char* pszName, void* ptr)
+    {
+        MahjongPersistentSegment* pstSegment = m_pstPageCache->GetPersistentSegment();
+        return pstSegment != nullptr && pstSegment->SetRoot(pszName, ptr);
+    }
+
+    // 查找根对象
+    void* MahjongHeap::GetRoot(const char* pszName)
+    {
+        MahjongPersistentSegment* pstSegment = m_pstPageCache->GetPersistentSegment();
+        return pstSegment != nullptr ? pstSegment->GetRoot(pszName) : nullptr;
+    }
+
+    bool MahjongHeap::IsPersistent()
+    {
+        return m_pstPageCache->GetPersistentSegment() != nullptr;
+    }
+
+    bool MahjongHeap::IsRecovered()
+    {
+        MahjongPersistentSegment* pstSegment = m_pstPageCache->GetPersistentSegment();
+        return pstSegment != nullptr && pstSegment->IsRecovered();
+    }
+
+    // 注销当前堆编号并释放全部线程缓存
+    void MahjongHeap::ReleaseAllThreadCache()
+    {
+        // 先注销编号，线程退出时不会再回收到本堆
+        UnregisterHeap(m_nHeapId.load(std::memory_order_relaxed));
+
+        std::lock_guard<std::mutex> lock(m_MutexLock);
+        for (MahjongThreadCache* pstThreadCache : m_vecThreadCache)
+        {
+            delete pstThreadCache;
+        }
+        m_vecThreadCache.clear();
+    }
+
+    // 持久化堆析构前记录中心自由链表
+    void MahjongHeap::SavePersistentFreeList()
+    {
+        // 线程缓存的块先还给中心缓存，块全部空闲的span再还给页缓存
+        {
+            std::lock_guard<std::mutex> lock(m_MutexLock);
+            for (MahjongThreadCache* pstThreadCache : m_vecThreadCache)
+            {
+                pstThreadCache->ReleaseAllCache();
+            }
+        }
+        m_pstCentralCache->ReleaseFreeSpan();
+
+        std::vector<MahjongPersistentSegment::FreeListEntry> vecFreeList;
+        for (size_t nIndex = 0; nIndex < FREE_LIST_SIZE; ++nIndex)
+        {
+            void* pstHead = m_pstCentralCache->GetFreeListHead(nIndex);
+            if (pstHead != nullptr)
+            {
+                vecFreeList.push_back({ nIndex, pstHead });
+            }
+        }
+
+        // 链表头表放在段内新切出的span中，段空间不足时放弃记录，这些块下次无法复用
+        MahjongPersistentSegment* pstSegment = m_pstPageCache->GetPersistentSegment();
+        pstSegment->SetFreeListTable(nullptr, 0);
+        if (!vecFreeList.empty())
+        {
+            size_t nTableSize = vecFreeList.size() * sizeof(MahjongPersistentSegment::FreeListEntry);
+            void* pstTable = m_pstPageCache->NewCacheByPageNum(MahjongPageCache::GetPageNumBySize(nTableSize));
+            if (pstTable != nullptr)
+            {
+                memcpy(pstTable, vecFreeList.data(), nTableSize);
+                pstSegment->SetFreeListTable(static_cast<MahjongPersistentSegment::FreeListEntry*>(pstTable), vecFreeList.size());
+            }
+        }
+
+        // 顶部的空闲页退还段，中间的空闲页只释放物理内存
+        m_pstPageCache->ReleaseFreeCache();
+    }
+
+    // 持久化堆挂载后恢复中心自由链表
+    void MahjongHeap::LoadPersistentFreeList()
+    {
+        MahjongPersistentSegment* pstSegment = m_pstPageCache->GetPersistentSegment();
+        size_t nNum = 0;
+        MahjongPersistentSegment::FreeListEntry* pstTable = pstSegment->GetFreeListTable(nNum);
+        if (pstTable == nullptr)
+        {
+            return;  // 新段或上次没有正常退出
+        }
+
+        // 链表头必须落在切分大小一致的span中，损坏的表项直接丢弃
+        for (size_t i = 0; i < nNum; ++i)
+        {
+            size_t nIndex = pstTable[i].m_nIndex;
+            if (nIndex < FREE_LIST_SIZE && GetUsableSize(pstTable[i].m_pstHead) == (nIndex + 1) * ALIGNMENT)
+            {
+                m_pstCentralCache->SetFreeListHead(nIndex, pstTable[i].m_pstHead);
+            }
+        }
+
+        // 表只用一次，清除记录后归还其span，异常退出时不会误用过期的链表头
+        pstSegment->SetFreeListTable(nullptr, 0);
+        m_pstPageCache->DeleteCacheByPageNum(pstTable,
+            MahjongPageCache::GetPageNumBySize(nNum * sizeof(MahjongPersistentSegment::FreeListEntry)));
+    }
+
+    // 释放全部线程缓存、中心缓存和页缓存
+    void MahjongHeap::ReleaseAllCache()
+    {
+        ReleaseAllThreadCache();
+
+        // 中心缓存中的块都在页缓存的span里，清空链表后整体归还系统
+        m_pstCentralCache->ReleaseAllCache();
+        m_pstPageCache->ReleaseAllCache();
+    }
+}
@@ -0,0 +1,144 @@
+/*
+   @Time     : 2018/7/16 14:05
+   @Author   : 王一冰
+   @Describe : 独立堆实例，持有自己的中心缓存、页缓存和配置
+   @Software : Copyright (c) 2018 中国手游娱乐集团有限公司
+*/
+#pragma once
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "mahjongthreadcache.h"
+#include "majhongcentralcache.h"
+#include "majhongpagecache.h"
+
+namespace MahjongMemoryPool
+{
+    // 工作集画像：(内存块大小, 该尺寸类同时在用的峰值块数)
+    using MahjongHeapProfile = std::vector<std::pair<size_t, size_t>>;
+
+    // 独立堆：不同子系统（聊天、回放录制等）各用一个堆，互不干扰，可整体释放
+    class MahjongHeap
+    {
+    public:
+        explicit MahjongHeap(const MahjongHeapConfig& stConfig = MahjongHeapConfig());
+        ~MahjongHeap();
+        MahjongHeap(const MahjongHeap&) = delete;
+        MahjongHeap& operator=(const MahjongHeap&) = delete;
+
+        // 进程默认堆，MemoryPool静态接口使用，永不析构
+        static MahjongHeap& GetDefaultHeap();
+
+        void* NewMemoryCache(size_t nSize)
+        {
+            return GetThreadCache()->MahjongNewCache(nSize);
+        }
+
+        void DeleteMemoryCache(void* ptr, size_t nSize)
+        {
+            GetThreadCache()->MahjongDeleteCache(ptr, nSize);
+        }
+
+        void* ResizeMemoryCache(void* ptr, size_t nOldSize, size_t nNewSize)
+        {
+            return GetThreadCache()->MahjongResizeCache(ptr, nOldSize, nNewSize);
+        }
+
+        size_t GetUsableSize(void* ptr)
+        {
+            return m_pstPageCache->GetUsableSize(ptr);
+        }
+
+        // 一次性释放本堆持有的全部内存（所有线程缓存、中心缓存和页），之前分配的指针全部失效
+        // 调用时不能有其他线程仍在使用本堆；释放后堆可以继续分配
+        // 持久化堆会清空段内的全部span和根对象；只想断开段时直接析构堆即可
+        void Destroy();
+
+        // 本堆当前向系统申请的字节数，用于按子系统统计内存
+        size_t GetSystemCacheSize() const
+        {
+            return m_pstPageCache->GetSystemCacheSize();
+        }
+
+        // 清空各级缓存并把空闲内存归还系统，返回归还系统的字节数
+        // 当前线程的线程缓存立即归还；其他线程的线程缓存在其下次访问中心缓存时整体归还
+        // 中心缓存中块已全部空闲的span归还页缓存，页缓存的空闲span随后归还系统
+        size_t ReleaseFreeMemory();
+        // 页缓存超过软上限时清空缓存并调用m_fnSoftLimitCallback，线程缓存在不持有任何锁时调用
+        void CheckMemoryPressure();
+        // 达到硬上限分配失败时先归还本线程的缓存，再清空中心缓存和页缓存；多个线程同时失败时合并清空
+        void ReleaseFreeMemoryByHardLimit();
+        // 归还轮次，每次ReleaseFreeMemory加一，线程缓存据此判断是否需要整体归还
+        uint64_t GetFlushEpoch() const
+        {
+            return m_nFlushEpoch.load(std::memory_order_relaxed);
+        }
+
+        // 遍历所有span生成碎片与占用报告：页缓存和各尺寸类依次短暂加锁复制，统计在锁外进行
+        MahjongHeapReport GetReport();
+
+        // 采集当前各尺寸类的工作集画像
+        MahjongHeapProfile GetProfile();
+        // 把工作集画像保存到文件，每行"内存块大小 块数"
+        bool SaveProfile(const std::string& strPath);
+        // 从文件读取工作集画像
+        static bool LoadProfile(const std::string& strPath, MahjongHeapProfile& vecProfile);
+        // 按画像预先映射页并切分到中心缓存，使各热点尺寸类的首次请求直接命中
+        void Prewarm(const MahjongHeapProfile& vecProfile);
+        // 读取画像文件并预热，bAsync为true时在后台线程执行
+        bool PrewarmByProfile(const std::string& strPath, bool bAsync = false);
+        // 等待后台预热结束
+        void WaitPrewarm();
+
+        // 持久化模式：配置了m_strPersistentName且段挂载成功时为true
+        bool IsPersistent();
+        // 是否挂载到了上次进程留下的段
+        bool IsRecovered();
+        // 登记/查找根对象，重启后通过名字找回段内的对象；非持久化堆返回false/nullptr
+        bool SetRoot(const char* pszName, void* ptr);
+        void* GetRoot(const char* pszName);
+
+        const MahjongHeapConfig& GetConfig() const { return m_stConfig; }
+        MahjongCentralCache& GetCentralCache() { return *m_pstCentralCache; }
+        MahjongPageCache& GetPageCache() { return *m_pstPageCache; }
+
+        // 获取当前线程在本堆上的线程缓存，首次访问时创建
+        MahjongThreadCache* GetThreadCache();
+        // 回收某个线程在本堆上的线程缓存（线程退出时调用）
+        void ReleaseThreadCache(MahjongThreadCache* pstThreadCache);
+        // 当前线程的线程缓存表项数，用于检查已销毁堆的表项是否被回收
+        static size_t GetThreadCacheTableSize();
+
+    private:
+        // 注销当前堆编号并释放全部线程缓存
+        void ReleaseAllThreadCache();
+        // 释放全部线程缓存、中心缓存和页缓存，并注销当前堆编号
+        void ReleaseAllCache();
+        // 持久化堆析构前把线程缓存和中心缓存的空闲块归还，并把中心自由链表头记录到段内
+        void SavePersistentFreeList();
+        // 持久化堆挂载后恢复上次记录的中心自由链表
+        void LoadPersistentFreeList();
+
+    private:
+        MahjongHeapConfig m_stConfig;
+        std::unique_ptr<MahjongPageCache> m_pstPageCache;
+        std::unique_ptr<MahjongCentralCache> m_pstCentralCache;
+
+        // 堆编号，线程本地缓存表以此为键；Destroy后更换编号，旧的线程缓存不会再被命中
+        std::atomic<uint64_t> m_nHeapId;
+        // 各线程在本堆上的线程缓存
+        std::vector<MahjongThreadCache*> m_vecThreadCache;
+        std::mutex m_MutexLock;
+        // 归还轮次
+        std::atomic<uint64_t> m_nFlushEpoch{ 0 };
+        // 是否有线程正在处理软上限，避免重复清空缓存和重复回调；硬上限不经过此标记
+        std::atomic<bool> m_bMemoryPressure{ false };
+        // 硬上限清空串行执行，按完成次数判断能否复用其他线程的清空
+        std::mutex m_HardLimitLock;
+        std::atomic<uint64_t> m_nHardLimitDrainNum{ 0 };
+        // 后台预热线程
+        std::thread m_PrewarmThread;
+    };
+}
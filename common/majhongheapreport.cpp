@@ -0,0 +1,47 @@
+#include <sstream>
+#include "majhongheapreport.h"
+
+namespace MahjongMemoryPool
+{
+    // 格式化为多行文本
+    std::string MahjongHeapReport::ToString() const
+    {
+        std::ostringstream stStream;
+        stStream << "system: " << m_nSystemCacheSize
+            << " small span: " << m_nSmallSpanSize
+            << " large span: " << m_nLargeSpanSize
+            << " free page: " << m_nFreePageNum << '\n';
+        stStream << "waste: tail " << m_nTailWasteSize
+            << " large rounding " << m_nLargeWasteSize << '\n';
+        stStream << "idle: central " << m_nCentralFreeSize
+            << " thread cache " << m_nThreadCacheSize
+            << " thread stash " << m_nThreadStashSize << '\n';
+
+        stStream << "free run: largest " << m_nLargestFreeRunPageNum << " pages";
+        for (size_t i = 0; i < m_vecFreeRun.size(); ++i)
+        {
+            if (m_vecFreeRun[i] != 0)
+            {
+                stStream << " [" << (size_t(1) << i) << ',' << (size_t(2) << i) << "):" << m_vecFreeRun[i];
+            }
+        }
+        stStream << '\n';
+
+        // 每行：块大小 span数 块数 中心空闲块数 尾部浪费 | 占用率十等分的span数
+        for (const MahjongSizeClassReport& stClass : m_vecSizeClass)
+        {
+            stStream << "class " << stClass.m_nObjectSize
+                << " span " << stClass.m_nSpanNum
+                << " block " << stClass.m_nBlockNum
+                << " central free " << stClass.m_nCentralFreeNum
+                << " tail waste " << stClass.m_nTailWasteSize
+                << " occupancy";
+            for (size_t nSpanNum : stClass.m_arrOccupancy)
+            {
+                stStream << ' ' << nSpanNum;
+            }
+            stStream << '\n';
+        }
+        return stStream.str();
+    }
+}
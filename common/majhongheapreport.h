@@ -0,0 +1,62 @@
+/*
+   @Time     : 2018/7/27 10:15
+   @Author   : 王一冰
+   @Describe : 堆碎片与span占用报告
+   @Software : Copyright (c) 2018 中国手游娱乐集团有限公司
+*/
+#pragma once
+#include <array>
+#include <string>
+#include <vector>
+#include "common.h"
+
+namespace MahjongMemoryPool
+{
+    // span快照，页缓存按地址顺序导出
+    struct MahjongSpanInfo
+    {
+        void* m_pstAddr;
+        size_t m_nPageNum;
+        size_t m_nObjectSize;    // span切分的内存块大小，0表示整块使用或空闲
+        size_t m_nRequestSize;   // 大对象申请的字节数，0表示未知
+        bool m_bInUse;
+        bool m_bStash;           // 在线程页暂存区中尚未切分
+    };
+
+    // 尺寸类的span占用统计
+    struct MahjongSizeClassReport
+    {
+        static const size_t OCCUPANCYBUCKETNUM = 10;
+
+        size_t m_nObjectSize = 0;
+        size_t m_nSpanNum = 0;
+        size_t m_nBlockNum = 0;          // 所有span切分出的块数
+        size_t m_nCentralFreeNum = 0;    // 其中在中心缓存中的空闲块数
+        size_t m_nTailWasteSize = 0;     // span尾部不足一块的字节数
+        // span按占用率十等分的个数，第i项占用率在[i*10%, (i+1)*10%)，最后一项含100%
+        // 占用率 = 不在中心缓存中的块数 / span块数，线程缓存中的空闲块计为占用
+        std::array<size_t, OCCUPANCYBUCKETNUM> m_arrOccupancy{};
+    };
+
+    // 堆报告：各项数据在不同时刻分段采集，并发分配时只是近似值
+    struct MahjongHeapReport
+    {
+        size_t m_nSystemCacheSize = 0;        // 向系统申请的字节数
+        size_t m_nSmallSpanSize = 0;          // 切分给小对象的span字节数
+        size_t m_nLargeSpanSize = 0;          // 大对象span字节数
+        size_t m_nLargeWasteSize = 0;         // 大对象按页取整多出的字节数
+        size_t m_nTailWasteSize = 0;          // 小对象span尾部浪费的字节数
+        size_t m_nCentralFreeSize = 0;        // 中心缓存中的空闲字节数
+        size_t m_nThreadCacheSize = 0;        // 各线程缓存中的空闲字节数
+        size_t m_nThreadStashSize = 0;        // 各线程页暂存区中尚未切分的span字节数
+        size_t m_nFreePageNum = 0;            // 页缓存空闲页数
+        size_t m_nLargestFreeRunPageNum = 0;  // 地址连续的最长空闲页数（相邻空闲span合并计算）
+        // 空闲span页数分布，第i项为页数在[2^i, 2^(i+1))的空闲span个数
+        std::vector<size_t> m_vecFreeRun;
+        // 有span的尺寸类，按内存块大小升序
+        std::vector<MahjongSizeClassReport> m_vecSizeClass;
+
+        // 格式化为多行文本
+        std::string ToString() const;
+    };
+}
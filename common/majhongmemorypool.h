@@ -1,21 +1,40 @@
 #pragma once
 #include <sys/mman.h>
 #include <cstring>
-#include "majhongpagecache.h"
+#include "majhongheap.h"
 
 namespace MahjongMemoryPool 
 {
+	// 默认堆的静态接口，需要隔离的子系统使用独立的MahjongHeap
 	class MemoryPool
 	{
 	public:
 		static void* NewMemoryCache(size_t nSize) 
 		{
-			return MahjongThreadCache::GetInstance().MahjongNewCache(nSize);
+			return MahjongHeap::GetDefaultHeap().NewMemoryCache(nSize);
 		}
 
 		static void DeleteMemoryCache(void* ptr, size_t nSize) 
 		{
-			MahjongThreadCache::GetInstance().MahjongDeleteCache(ptr, nSize);
+			MahjongHeap::GetDefaultHeap().DeleteMemoryCache(ptr, nSize);
+		}
+
+		// 调整内存块大小，新大小仍在原尺寸类或大对象span可原地扩展时返回原指针
+		static void* ResizeMemoryCache(void* ptr, size_t nOldSize, size_t nNewSize)
+		{
+			return MahjongHeap::GetDefaultHeap().ResizeMemoryCache(ptr, nOldSize, nNewSize);
+		}
+
+		// 查询内存块实际可用的字节数（所在尺寸类大小或大对象span的整页大小）
+		static size_t GetUsableSize(void* ptr)
+		{
+			return MahjongHeap::GetDefaultHeap().GetUsableSize(ptr);
+		}
+
+		// 清空默认堆的各级缓存并把空闲内存归还系统，返回归还的字节数
+		static size_t ReleaseFreeMemory()
+		{
+			return MahjongHeap::GetDefaultHeap().ReleaseFreeMemory();
 		}
 	};
 }
\ No newline at end of file
@@ -1,58 +1,164 @@
+#include <algorithm>
+#include <chrono>
 #include <cstring>
 #include "sys/mman.h"
 #include "majhongpagecache.h"
 
 namespace MahjongMemoryPool    
 {
-    // 从系统中分配指定页数的内存
-    void* MahjongPageCache::NewCacheByPageNum(size_t nPageNum)
+    namespace
     {
-        std::lock_guard<std::mutex> lock(m_MutexLock);  // 加锁保证线程安全
+        // 线程按首次使用页缓存的顺序轮流分配到各分片
+        std::atomic<size_t> g_nNextShard{ 0 };
+        thread_local size_t t_nShard = g_nNextShard.fetch_add(1, std::memory_order_relaxed);
+    }
 
-        // 在空闲页链表中查找第一个不小于需求页数的节点
-        auto it = m_FreePageNode.lower_bound(nPageNum);
-        if (it != m_FreePageNode.end())  // 如果找到合适节点
+    MahjongPageCache::MahjongPageCache(const MahjongHeapConfig* pstConfig)
+        : m_pstConfig(pstConfig)
+    {
+        // 持久化段从同一个段顶部切页，只用一个分片
+        size_t nShardNum = 1;
+        if (pstConfig != nullptr && pstConfig->m_strPersistentName.empty())
         {
-            PageNode* pstPageNode = it->second;  // 获取空闲页节点
+            nShardNum = std::max(pstConfig->m_nPageShardNum, size_t(1));
+        }
+
+        for (size_t i = 0; i < nShardNum; ++i)
+        {
+            m_vecShard.emplace_back(new PageShard());
+        }
+    }
 
-            // 处理链表连接：如果当前节点有后续节点
-            if (pstPageNode->pNext)
+    MahjongPageCache::~MahjongPageCache()
+    {
+        // 持久化段只断开映射，段内的堆留给下次挂载
+        if (m_pstSegment)
+        {
+            for (auto& stNode : m_vecShard[0]->m_WorkPageNode)
             {
-                m_FreePageNode[it->first] = pstPageNode->pNext;  // 更新哈希表指向下一个节点
+                delete stNode.second;
             }
-            else  // 如果这是最后一个节点
+            return;
+        }
+        ReleaseAllCache();
+    }
+
+    // 从持久化段创建页缓存，段已存在时按span表重建所有span
+    bool MahjongPageCache::AttachPersistentSegment(const std::string& strName, uintptr_t nBaseAddr, size_t nSize)
+    {
+        PageShard& stShard = *m_vecShard[0];
+        std::lock_guard<std::mutex> lock(stShard.m_MutexLock);
+        if (m_pstSegment || m_vecShard.size() != 1 || !stShard.m_WorkPageNode.empty())
+        {
+            return false;  // 只能在分配任何内存之前挂载，且只支持单分片
+        }
+
+        std::unique_ptr<MahjongPersistentSegment> pstSegment(new MahjongPersistentSegment());
+        if (!pstSegment->Open(strName, nBaseAddr, nSize))
+        {
+            return false;
+        }
+
+        // span在段内首尾相接，按表项页数逐个跳过即可遍历全部span
+        char* pstTop = pstSegment->GetDataTop();
+        for (char* pstAddr = pstSegment->GetDataStart(); pstAddr < pstTop;)
+        {
+            const MahjongPersistentSegment::SpanEntry& stEntry = pstSegment->GetSpan(pstAddr);
+            if (stEntry.m_nPageNum == 0)
             {
-                m_FreePageNode.erase(it);  // 直接从哈希表中删除该条目
+                break;  // span表损坏，后续的页不再使用
             }
 
-            // 如果当前节点页数大于需求，需要分割
-            if (pstPageNode->nPageNum > nPageNum)
+            PageNode* pstPageNode = new PageNode;
+            pstPageNode->pPageAddr = pstAddr;
+            pstPageNode->nPageNum = stEntry.m_nPageNum;
+            pstPageNode->pNext = nullptr;
+            pstPageNode->bInUse = stEntry.m_bInUse != 0;
+            pstPageNode->nObjectSize = stEntry.m_nObjectSize;
+            pstPageNode->bStash = false;
+            pstPageNode->nRequestSize = 0;
+
+            stShard.m_WorkPageNode[pstAddr] = pstPageNode;
+            if (!pstPageNode->bInUse)
             {
-                PageNode* pstNewPageNode = new PageNode;  // 创建新节点存放剩余页
-                // 计算剩余内存块的起始地址
-                pstNewPageNode->pPageAddr = static_cast<char*>(pstPageNode->pPageAddr) + nPageNum * PAGESIZE;
-                pstNewPageNode->nPageNum = pstPageNode->nPageNum - nPageNum;  // 计算剩余页数
-                pstNewPageNode->pNext = nullptr;  // 新节点暂时没有后续节点
+                InsertFreePageNode(stShard, pstPageNode);
+            }
+            pstAddr += stEntry.m_nPageNum * PAGESIZE;
+        }
 
-                // 将新节点插入对应页数的空闲链表
-                auto& pstList = m_FreePageNode[pstNewPageNode->nPageNum];
-                pstNewPageNode->pNext = pstList;  // 新节点指向原链表头
-                pstList = pstNewPageNode;         // 更新链表头为新节点
+        m_nSystemCacheSize.store(pstSegment->GetUsedSize(), std::memory_order_relaxed);
+        m_pstSegment = std::move(pstSegment);
+        return true;
+    }
+
+    // 从系统中分配指定页数的内存
+    void* MahjongPageCache::NewCacheByPageNum(size_t nPageNum, size_t nRequestSize, size_t nObjectSize)
+    {
+        size_t nLocalShard = GetLocalShard();
+        std::unique_lock<std::mutex> lock = LockShard(*m_vecShard[nLocalShard]);  // 加锁保证线程安全
+
+        void* pstCache = NewCacheByShard(nLocalShard, nPageNum, nRequestSize, nObjectSize, false);
 
-                // 调整原节点为实际需求大小
-                pstPageNode->nPageNum = nPageNum;
+        // 本分片没有合适的空闲span时借用其他分片的空闲页，正忙的分片直接跳过，不互相等待
+        for (size_t i = 1; pstCache == nullptr && i < m_vecShard.size(); ++i)
+        {
+            size_t nShard = (nLocalShard + i) % m_vecShard.size();
+            std::unique_lock<std::mutex> stLock(m_vecShard[nShard]->m_MutexLock, std::try_to_lock);
+            if (stLock.owns_lock())
+            {
+                pstCache = NewCacheByShard(nShard, nPageNum, nRequestSize, nObjectSize, false);
+            }
+            else
+            {
+                m_nTryLockFailNum.fetch_add(1, std::memory_order_relaxed);
             }
+        }
+
+        // 都没有时在本分片向系统申请
+        if (pstCache == nullptr)
+        {
+            pstCache = NewCacheByShard(nLocalShard, nPageNum, nRequestSize, nObjectSize, true);
+        }
+        return pstCache;
+    }
+
+    // 在分片中分配span（调用方持有分片的锁）
+    void* MahjongPageCache::NewCacheByShard(size_t nShard, size_t nPageNum, size_t nRequestSize, size_t nObjectSize, bool bSystem)
+    {
+        PageShard& stShard = *m_vecShard[nShard];
+
+        // 在空闲页链表中查找第一个不小于需求页数的节点
+        auto it = stShard.m_FreePageNode.lower_bound(nPageNum);
+        if (it != stShard.m_FreePageNode.end())  // 如果找到合适节点
+        {
+            PageNode* pstPageNode = it->second;  // 获取空闲页节点
+            RemoveFreePageNode(stShard, pstPageNode);
 
-            // 将分配的节点移入工作链表
-            m_WorkPageNode[pstPageNode->pPageAddr] = pstPageNode;
+            // 如果当前节点页数大于需求，需要分割
+            if (pstPageNode->nPageNum > nPageNum)
+            {
+                SplitPageNode(stShard, pstPageNode, nPageNum);
+            }
+
+            // 标记为工作中的节点
+            pstPageNode->bInUse = true;
+            pstPageNode->nObjectSize = nObjectSize;
+            pstPageNode->bStash = false;
+            pstPageNode->nRequestSize = nRequestSize;
+            SyncPageNode(pstPageNode);
             return pstPageNode->pPageAddr;  // 返回分配的内存地址
         }
 
+        if (!bSystem)
+        {
+            return nullptr;
+        }
+
         // 没有找到合适空闲块，直接向系统申请新内存
-        void* pstNewCache = NewCacheBySystem(nPageNum);
+        void* pstNewCache = NewCacheBySystem(nShard, nPageNum);
         if (pstNewCache == nullptr)
         {
-            return nullptr;  // 注意：原代码缺少分号，可能需要修正
+            return nullptr;
         }
 
         // 创建新页节点记录分配信息
@@ -60,77 +166,644 @@ namespace MahjongMemoryPool
         pstNewPageNode->pPageAddr = pstNewCache;
         pstNewPageNode->nPageNum = nPageNum;
         pstNewPageNode->pNext = nullptr;
+        pstNewPageNode->bInUse = true;
+        pstNewPageNode->nObjectSize = nObjectSize;
+        pstNewPageNode->bStash = false;
+        pstNewPageNode->nRequestSize = nRequestSize;
 
         // 注册到工作链表
-        m_WorkPageNode[pstNewPageNode->pPageAddr] = pstNewPageNode;
+        stShard.m_WorkPageNode[pstNewPageNode->pPageAddr] = pstNewPageNode;
+        SyncPageNode(pstNewPageNode);
         return pstNewCache;
     }
 
     // 释放指定页数的内存
     void MahjongPageCache::DeleteCacheByPageNum(void* ptr, size_t nPageNum)
     {
-        std::lock_guard<std::mutex> lock(m_MutexLock);  // 加锁保证线程安全
+        PageShard* pstShard = GetShardByAddr(ptr);
+        if (pstShard == nullptr)
+        {
+            return;
+        }
+        PageShard& stShard = *pstShard;
+        std::unique_lock<std::mutex> lock = LockShard(stShard);  // 加锁保证线程安全
 
         // 在工作链表中查找目标节点
-        auto pstCurNode = m_WorkPageNode.find(ptr);
-        if (pstCurNode == m_WorkPageNode.end())
+        auto pstCurNode = stShard.m_WorkPageNode.find(ptr);
+        if (pstCurNode == stShard.m_WorkPageNode.end() || !pstCurNode->second->bInUse)
         {
             return;  // 未找到直接返回（可能已释放）
         }
 
+        // 以节点记录的页数为准（span可能被原地扩展或缩小过）
         PageNode* pstPageNode = pstCurNode->second;  // 获取页节点
-
-        // 计算相邻内存块地址
-        void* pstNextAddr = static_cast<char*>(ptr) + nPageNum * PAGESIZE;
-        auto pstNextNode = m_WorkPageNode.find(pstNextAddr);
+        pstPageNode->bInUse = false;
+        pstPageNode->nObjectSize = 0;
+        pstPageNode->bStash = false;
+        pstPageNode->nRequestSize = 0;
+        (void)nPageNum;
 
         // 尝试合并后续相邻空闲块
-        if (pstNextNode != m_WorkPageNode.end())
+        auto pstNextNode = stShard.m_WorkPageNode.find(static_cast<char*>(ptr) + pstPageNode->nPageNum * PAGESIZE);
+        if (pstNextNode != stShard.m_WorkPageNode.end() && !pstNextNode->second->bInUse)
         {
             PageNode* pstNextPageNode = pstNextNode->second;
-            bool bFind = false;
-            auto& pstNextList = m_FreePageNode[pstNextPageNode->nPageNum];
+            RemoveFreePageNode(stShard, pstNextPageNode);
+            pstPageNode->nPageNum += pstNextPageNode->nPageNum;  // 合并页数
+            stShard.m_WorkPageNode.erase(pstNextNode);  // 从工作链表移除
+            ClearPageNode(pstNextPageNode);
+            delete pstNextPageNode;
+        }
+
+        // 尝试合并前面相邻的空闲块
+        auto pstPrevNode = stShard.m_WorkPageNode.find(ptr);
+        if (pstPrevNode != stShard.m_WorkPageNode.begin())
+        {
+            --pstPrevNode;
+            PageNode* pstPrevPageNode = pstPrevNode->second;
+            if (!pstPrevPageNode->bInUse &&
+                static_cast<char*>(pstPrevPageNode->pPageAddr) + pstPrevPageNode->nPageNum * PAGESIZE == ptr)
+            {
+                RemoveFreePageNode(stShard, pstPrevPageNode);
+                pstPrevPageNode->nPageNum += pstPageNode->nPageNum;
+                stShard.m_WorkPageNode.erase(ptr);
+                ClearPageNode(pstPageNode);
+                delete pstPageNode;
+                pstPageNode = pstPrevPageNode;
+            }
+        }
+
+        // 将当前节点插入空闲链表
+        InsertFreePageNode(stShard, pstPageNode);
+        SyncPageNode(pstPageNode);
+    }
+
+    // 一次性向系统申请指定页数放入空闲链表
+    bool MahjongPageCache::ReserveCacheByPageNum(size_t nPageNum)
+    {
+        if (nPageNum == 0)
+        {
+            return true;
+        }
+
+        size_t nLocalShard = GetLocalShard();
+        PageShard& stShard = *m_vecShard[nLocalShard];
+        std::unique_lock<std::mutex> lock = LockShard(stShard);
+
+        // NewCacheBySystem会清零整块内存，页在此时已全部缺页映射
+        void* pstNewCache = NewCacheBySystem(nLocalShard, nPageNum);
+        if (pstNewCache == nullptr)
+        {
+            return false;
+        }
+
+        PageNode* pstNewPageNode = new PageNode;
+        pstNewPageNode->pPageAddr = pstNewCache;
+        pstNewPageNode->nPageNum = nPageNum;
+        pstNewPageNode->pNext = nullptr;
+        pstNewPageNode->bInUse = false;
+        pstNewPageNode->nObjectSize = 0;
+        pstNewPageNode->bStash = false;
+        pstNewPageNode->nRequestSize = 0;
+
+        stShard.m_WorkPageNode[pstNewPageNode->pPageAddr] = pstNewPageNode;
+        InsertFreePageNode(stShard, pstNewPageNode);
+        SyncPageNode(pstNewPageNode);
+        return true;
+    }
+
+    // 原地调整span页数
+    bool MahjongPageCache::ResizeCacheByPageNum(void* ptr, size_t nNewPageNum, size_t nRequestSize)
+    {
+        PageShard* pstShard = GetShardByAddr(ptr);
+        if (pstShard == nullptr)
+        {
+            return false;
+        }
+        PageShard& stShard = *pstShard;
+        std::unique_lock<std::mutex> lock = LockShard(stShard);
+
+        auto pstCurNode = stShard.m_WorkPageNode.find(ptr);
+        if (pstCurNode == stShard.m_WorkPageNode.end() || !pstCurNode->second->bInUse || nNewPageNum == 0)
+        {
+            return false;
+        }
+
+        PageNode* pstPageNode = pstCurNode->second;
+        if (nNewPageNum <= pstPageNode->nPageNum)
+        {
+            // 缩小：尾部多余的页切出来放回空闲链表
+            if (nNewPageNum < pstPageNode->nPageNum)
+            {
+                SplitPageNode(stShard, pstPageNode, nNewPageNum);
+            }
+            pstPageNode->nRequestSize = nRequestSize;
+            return true;
+        }
+
+        // 扩大：只有紧邻的后续span空闲且足够大时才能原地扩展
+        auto pstNextNode = stShard.m_WorkPageNode.find(static_cast<char*>(ptr) + pstPageNode->nPageNum * PAGESIZE);
+        if (pstNextNode == stShard.m_WorkPageNode.end() || pstNextNode->second->bInUse)
+        {
+            return false;
+        }
+
+        PageNode* pstNextPageNode = pstNextNode->second;
+        size_t nNeedPageNum = nNewPageNum - pstPageNode->nPageNum;
+        if (pstNextPageNode->nPageNum < nNeedPageNum)
+        {
+            return false;
+        }
+
+        RemoveFreePageNode(stShard, pstNextPageNode);
+        if (pstNextPageNode->nPageNum > nNeedPageNum)
+        {
+            SplitPageNode(stShard, pstNextPageNode, nNeedPageNum);
+        }
+
+        pstPageNode->nPageNum += pstNextPageNode->nPageNum;
+        pstPageNode->nRequestSize = nRequestSize;
+        stShard.m_WorkPageNode.erase(pstNextNode);
+        ClearPageNode(pstNextPageNode);
+        delete pstNextPageNode;
+        SyncPageNode(pstPageNode);
+        return true;
+    }
+
+    // 查询指针所在内存块的实际可用字节数
+    size_t MahjongPageCache::GetUsableSize(void* ptr)
+    {
+        PageShard* pstShard = GetShardByAddr(ptr);
+        if (pstShard == nullptr)
+        {
+            return 0;
+        }
+        PageShard& stShard = *pstShard;
+        std::unique_lock<std::mutex> lock = LockShard(stShard);
+
+        PageNode* pstPageNode = FindPageNodeByAddr(stShard, ptr);
+        if (pstPageNode == nullptr || !pstPageNode->bInUse)
+        {
+            return 0;
+        }
+
+        // 小对象span返回切分大小，大对象span返回整块页大小
+        if (pstPageNode->nObjectSize != 0)
+        {
+            return pstPageNode->nObjectSize;
+        }
+        return pstPageNode->nPageNum * PAGESIZE;
+    }
+
+    // 查询指针所在的已分配span
+    bool MahjongPageCache::GetSpanByAddr(void* ptr, void*& pstSpanAddr, size_t& nPageNum)
+    {
+        PageShard* pstShard = GetShardByAddr(ptr);
+        if (pstShard == nullptr)
+        {
+            return false;
+        }
+        PageShard& stShard = *pstShard;
+        std::unique_lock<std::mutex> lock = LockShard(stShard);
+
+        PageNode* pstPageNode = FindPageNodeByAddr(stShard, ptr);
+        if (pstPageNode == nullptr || !pstPageNode->bInUse)
+        {
+            return false;
+        }
+
+        pstSpanAddr = pstPageNode->pPageAddr;
+        nPageNum = pstPageNode->nPageNum;
+        return true;
+    }
+
+    // 按地址顺序导出所有span的快照
+    std::vector<MahjongSpanInfo> MahjongPageCache::GetSpanInfo()
+    {
+        // 逐个分片加锁复制，各分片内已按地址有序，最后整体排序
+        std::vector<MahjongSpanInfo> vecSpan;
+        for (auto& pstShard : m_vecShard)
+        {
+            PageShard& stShard = *pstShard;
+            std::unique_lock<std::mutex> lock = LockShard(stShard);
+            for (auto& stNode : stShard.m_WorkPageNode)
+            {
+                PageNode* pstPageNode = stNode.second;
+                bool bStash = pstPageNode->bStash.load(std::memory_order_acquire);
+                vecSpan.push_back({ pstPageNode->pPageAddr, pstPageNode->nPageNum,
+                    pstPageNode->nObjectSize.load(std::memory_order_relaxed), pstPageNode->nRequestSize, pstPageNode->bInUse, bStash });
+            }
+        }
+
+        std::sort(vecSpan.begin(), vecSpan.end(), [](const MahjongSpanInfo& stLeft, const MahjongSpanInfo& stRight)
+        {
+            return stLeft.m_pstAddr < stRight.m_pstAddr;
+        });
+        return vecSpan;
+    }
+
+    // 把所有空闲span归还系统
+    size_t MahjongPageCache::ReleaseFreeCache()
+    {
+        size_t nReleaseSize = 0;
+        for (auto& pstShard : m_vecShard)
+        {
+            nReleaseSize += ReleaseFreeCacheByShard(*pstShard);
+        }
+
+        m_nSystemCacheSize.fetch_sub(nReleaseSize, std::memory_order_relaxed);
+        return nReleaseSize;
+    }
+
+    // 把分片的空闲span归还系统
+    size_t MahjongPageCache::ReleaseFreeCacheByShard(PageShard& stShard)
+    {
+        std::unique_lock<std::mutex> lock = LockShard(stShard);
+
+        // 先取出全部空闲span，持久化段中无法退还的再放回空闲链表
+        std::vector<PageNode*> vecFreePageNode;
+        for (auto& stFreeList : stShard.m_FreePageNode)
+        {
+            for (PageNode* pstPageNode = stFreeList.second; pstPageNode != nullptr; pstPageNode = pstPageNode->pNext)
+            {
+                vecFreePageNode.push_back(pstPageNode);
+            }
+        }
+        stShard.m_FreePageNode.clear();
 
-            // 从空闲链表中移除后续节点
-            if (pstNextList == pstNextPageNode)  // 如果是链表头
+        size_t nReleaseSize = 0;
+        for (PageNode* pstPageNode : vecFreePageNode)
+        {
+            size_t nSize = pstPageNode->nPageNum * PAGESIZE;
+            if (m_pstSegment)
             {
-                pstNextList = pstNextPageNode->pNext;
-                bFind = true;
+                // 持久化段只能从顶部退还页，中间的空闲span只释放物理内存
+                if (!m_pstSegment->DeletePages(pstPageNode->pPageAddr, pstPageNode->nPageNum))
+                {
+                    madvise(pstPageNode->pPageAddr, nSize, MADV_REMOVE);
+                    InsertFreePageNode(stShard, pstPageNode);
+                    continue;
+                }
             }
-            else if (pstNextList)  // 遍历链表查找
+            else
             {
-                PageNode* pstTemp = pstNextList;
-                while (pstTemp->pNext)
+                // 先删除区域记录再munmap：否则其他分片可能在此期间mmap到同一地址，新区域的记录随后被误删
                 {
-                    if (pstTemp->pNext == pstNextPageNode)
-                    {
-                        pstTemp->pNext = pstNextPageNode->pNext;
-                        bFind = true;
-                        break;
-                    }
-                    pstTemp = pstTemp->pNext;
+                    std::lock_guard<std::shared_timed_mutex> stLock(m_SystemCacheLock);
+                    RemoveSystemCache(pstPageNode->pPageAddr, nSize);
                 }
+                munmap(pstPageNode->pPageAddr, nSize);
             }
 
-            // 如果找到并移除了后续节点
-            if (bFind)
+            ClearPageNode(pstPageNode);
+            stShard.m_WorkPageNode.erase(pstPageNode->pPageAddr);
+            delete pstPageNode;
+            nReleaseSize += nSize;
+        }
+        return nReleaseSize;
+    }
+
+    // 把向系统申请的内存全部归还系统
+    void MahjongPageCache::ReleaseAllCache()
+    {
+        // 按分片顺序加锁，再加区域记录的写锁
+        std::vector<std::unique_lock<std::mutex>> vecLock;
+        for (auto& pstShard : m_vecShard)
+        {
+            vecLock.emplace_back(pstShard->m_MutexLock);
+        }
+        std::lock_guard<std::shared_timed_mutex> lock(m_SystemCacheLock);
+
+        for (auto& pstShard : m_vecShard)
+        {
+            for (auto& stNode : pstShard->m_WorkPageNode)
             {
-                pstPageNode->nPageNum += pstNextPageNode->nPageNum;  // 合并页数
-                m_WorkPageNode.erase(pstNextAddr);  // 从工作链表移除
-                delete pstNextPageNode;             // 删除节点对象（注意：原代码写delete pstNextAddr可能有误）
+                delete stNode.second;
             }
+            pstShard->m_WorkPageNode.clear();
+            pstShard->m_FreePageNode.clear();
         }
 
-        // 将当前节点插入空闲链表
-        auto& pstList = m_FreePageNode[pstPageNode->nPageNum];
+        // 持久化段整体清空，页留在段内
+        if (m_pstSegment)
+        {
+            m_pstSegment->Reset();
+        }
+
+        for (auto& stCache : m_SystemCache)
+        {
+            munmap(stCache.first, stCache.second.m_nSize);
+        }
+        m_SystemCache.clear();
+        m_nSystemCacheSize.store(0, std::memory_order_relaxed);
+    }
+
+    // 查找包含指定地址的span节点
+    MahjongPageCache::PageNode* MahjongPageCache::FindPageNodeByAddr(PageShard& stShard, void* ptr)
+    {
+        // 第一个起始地址大于ptr的节点的前一个节点即为候选
+        auto it = stShard.m_WorkPageNode.upper_bound(ptr);
+        if (it == stShard.m_WorkPageNode.begin())
+        {
+            return nullptr;
+        }
+        --it;
+
+        PageNode* pstPageNode = it->second;
+        char* pstEnd = static_cast<char*>(pstPageNode->pPageAddr) + pstPageNode->nPageNum * PAGESIZE;
+        if (static_cast<char*>(ptr) >= pstEnd)
+        {
+            return nullptr;
+        }
+        return pstPageNode;
+    }
+
+    // 将节点插入对应页数的空闲链表
+    void MahjongPageCache::InsertFreePageNode(PageShard& stShard, PageNode* pstPageNode)
+    {
+        auto& pstList = stShard.m_FreePageNode[pstPageNode->nPageNum];
         pstPageNode->pNext = pstList;  // 当前节点指向原链表头
         pstList = pstPageNode;         // 更新链表头为当前节点
     }
 
+    // 将节点从对应页数的空闲链表中摘除
+    void MahjongPageCache::RemoveFreePageNode(PageShard& stShard, PageNode* pstPageNode)
+    {
+        auto it = stShard.m_FreePageNode.find(pstPageNode->nPageNum);
+        if (it == stShard.m_FreePageNode.end())
+        {
+            return;
+        }
+
+        if (it->second == pstPageNode)  // 如果是链表头
+        {
+            it->second = pstPageNode->pNext;
+        }
+        else  // 遍历链表查找
+        {
+            PageNode* pstTemp = it->second;
+            while (pstTemp && pstTemp->pNext != pstPageNode)
+            {
+                pstTemp = pstTemp->pNext;
+            }
+            if (pstTemp)
+            {
+                pstTemp->pNext = pstPageNode->pNext;
+            }
+        }
+
+        // 链表已空时删除条目，避免lower_bound命中空链表
+        if (it->second == nullptr)
+        {
+            stShard.m_FreePageNode.erase(it);
+        }
+        pstPageNode->pNext = nullptr;
+    }
+
+    // 从span头部切出指定页数，剩余页作为新的空闲span
+    void MahjongPageCache::SplitPageNode(PageShard& stShard, PageNode* pstPageNode, size_t nPageNum)
+    {
+        PageNode* pstNewPageNode = new PageNode;  // 创建新节点存放剩余页
+        // 计算剩余内存块的起始地址
+        pstNewPageNode->pPageAddr = static_cast<char*>(pstPageNode->pPageAddr) + nPageNum * PAGESIZE;
+        pstNewPageNode->nPageNum = pstPageNode->nPageNum - nPageNum;  // 计算剩余页数
+        pstNewPageNode->pNext = nullptr;
+        pstNewPageNode->bInUse = false;
+        pstNewPageNode->nObjectSize = 0;
+        pstNewPageNode->bStash = false;
+        pstNewPageNode->nRequestSize = 0;
+
+        // 调整原节点为实际需求大小
+        pstPageNode->nPageNum = nPageNum;
+
+        // 剩余部分如果紧邻另一个空闲span则直接合并
+        auto pstNextNode = stShard.m_WorkPageNode.find(static_cast<char*>(pstNewPageNode->pPageAddr) + pstNewPageNode->nPageNum * PAGESIZE);
+        if (pstNextNode != stShard.m_WorkPageNode.end() && !pstNextNode->second->bInUse)
+        {
+            PageNode* pstNextPageNode = pstNextNode->second;
+            RemoveFreePageNode(stShard, pstNextPageNode);
+            pstNewPageNode->nPageNum += pstNextPageNode->nPageNum;
+            stShard.m_WorkPageNode.erase(pstNextNode);
+            ClearPageNode(pstNextPageNode);
+            delete pstNextPageNode;
+        }
+
+        stShard.m_WorkPageNode[pstNewPageNode->pPageAddr] = pstNewPageNode;
+        InsertFreePageNode(stShard, pstNewPageNode);
+        SyncPageNode(pstPageNode);
+        SyncPageNode(pstNewPageNode);
+    }
+
+    // 把span信息写穿到持久化段的span表
+    void MahjongPageCache::SyncPageNode(PageNode* pstPageNode)
+    {
+        if (m_pstSegment)
+        {
+            m_pstSegment->SetSpan(pstPageNode->pPageAddr, pstPageNode->nPageNum, pstPageNode->nObjectSize, pstPageNode->bInUse);
+        }
+    }
+
+    // 被合并掉的span清除表项
+    void MahjongPageCache::ClearPageNode(PageNode* pstPageNode)
+    {
+        if (m_pstSegment)
+        {
+            m_pstSegment->ClearSpan(pstPageNode->pPageAddr);
+        }
+    }
+
+    // 从系统内存区域记录中扣除已归还系统的地址范围
+    void MahjongPageCache::RemoveSystemCache(void* ptr, size_t nSize)
+    {
+        // 合并后的空闲span可能横跨多次mmap的区域，也可能只占区域的一部分
+        char* pstStart = static_cast<char*>(ptr);
+        char* pstEnd = pstStart + nSize;
+
+        auto it = m_SystemCache.upper_bound(ptr);
+        if (it != m_SystemCache.begin())
+        {
+            --it;
+        }
+
+        while (it != m_SystemCache.end() && static_cast<char*>(it->first) < pstEnd)
+        {
+            char* pstCacheStart = static_cast<char*>(it->first);
+            char* pstCacheEnd = pstCacheStart + it->second.m_nSize;
+            size_t nShard = it->second.m_nShard;
+            if (pstCacheEnd <= pstStart)
+            {
+                ++it;
+                continue;
+            }
+
+            it = m_SystemCache.erase(it);
+            if (pstCacheStart < pstStart)
+            {
+                m_SystemCache.emplace(pstCacheStart, SystemCache{ size_t(pstStart - pstCacheStart), nShard });
+            }
+            if (pstCacheEnd > pstEnd)
+            {
+                it = m_SystemCache.emplace(pstEnd, SystemCache{ size_t(pstCacheEnd - pstEnd), nShard }).first;
+                ++it;
+            }
+        }
+    }
+
+    // 当前线程优先使用的分片
+    size_t MahjongPageCache::GetLocalShard() const
+    {
+        return t_nShard % m_vecShard.size();
+    }
+
+    // 加分片锁，锁被占用时统计等待次数和时长
+    std::unique_lock<std::mutex> MahjongPageCache::LockShard(PageShard& stShard)
+    {
+        std::unique_lock<std::mutex> lock(stShard.m_MutexLock, std::try_to_lock);
+        if (!lock.owns_lock())
+        {
+            auto tStart = std::chrono::steady_clock::now();
+            lock.lock();
+            auto tWait = std::chrono::steady_clock::now() - tStart;
+            m_nLockWaitNum.fetch_add(1, std::memory_order_relaxed);
+            m_nLockWaitTime.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(tWait).count(), std::memory_order_relaxed);
+        }
+        return lock;
+    }
+
+    // 查找地址所属的分片
+    MahjongPageCache::PageShard* MahjongPageCache::GetShardByAddr(void* ptr)
+    {
+        // 单分片（含持久化段）不需要查区域记录
+        if (m_vecShard.size() == 1)
+        {
+            return m_vecShard[0].get();
+        }
+
+        std::shared_lock<std::shared_timed_mutex> lock(m_SystemCacheLock);
+        auto it = m_SystemCache.upper_bound(ptr);
+        if (it == m_SystemCache.begin())
+        {
+            return nullptr;
+        }
+        --it;
+
+        if (static_cast<char*>(ptr) >= static_cast<char*>(it->first) + it->second.m_nSize)
+        {
+            return nullptr;
+        }
+        return m_vecShard[it->second.m_nShard].get();
+    }
+
+    // 从线程页暂存区分配span
+    void* MahjongPageCache::NewCacheByStash(MahjongPageStash& stStash, size_t nPageNum, size_t nStashNum, size_t nObjectSize)
+    {
+        nStashNum = std::min(nStashNum, stStash.m_arrSpan.size());
+        if (stStash.m_nPageNum != nPageNum)
+        {
+            ReleaseStash(stStash);
+            stStash.m_nPageNum = nPageNum;
+        }
+
+        if (stStash.m_nSpanNum == 0)
+        {
+            // 在本线程的分片中一次切出nStashNum个span，只加一次锁
+            size_t nLocalShard = GetLocalShard();
+            PageShard& stShard = *m_vecShard[nLocalShard];
+            std::unique_lock<std::mutex> lock = LockShard(stShard);
+
+            // 空闲链表没有足够大的span时整块向系统申请，避免逐个span映射
+            if (stShard.m_FreePageNode.lower_bound(nPageNum * nStashNum) == stShard.m_FreePageNode.end())
+            {
+                void* pstNewCache = NewCacheBySystem(nLocalShard, nPageNum * nStashNum);
+                if (pstNewCache != nullptr)
+                {
+                    PageNode* pstNewPageNode = new PageNode;
+                    pstNewPageNode->pPageAddr = pstNewCache;
+                    pstNewPageNode->nPageNum = nPageNum * nStashNum;
+                    pstNewPageNode->pNext = nullptr;
+                    pstNewPageNode->bInUse = false;
+                    pstNewPageNode->nObjectSize = 0;
+                    pstNewPageNode->bStash = false;
+                    pstNewPageNode->nRequestSize = 0;
+                    stShard.m_WorkPageNode[pstNewPageNode->pPageAddr] = pstNewPageNode;
+                    InsertFreePageNode(stShard, pstNewPageNode);
+                    SyncPageNode(pstNewPageNode);
+                }
+            }
+
+            // 按地址倒序放入，先分配出去的span地址较低
+            for (size_t i = 0; i < nStashNum; ++i)
+            {
+                void* pstSpan = NewCacheByShard(nLocalShard, nPageNum, 0, 0, true);
+                if (pstSpan == nullptr)
+                {
+                    break;
+                }
+                PageNode* pstPageNode = stShard.m_WorkPageNode[pstSpan];
+                pstPageNode->bStash = true;
+                stStash.m_arrSpan[stStash.m_nSpanNum++] = pstPageNode;
+            }
+            std::reverse(stStash.m_arrSpan.begin(), stStash.m_arrSpan.begin() + stStash.m_nSpanNum);
+        }
+
+        if (stStash.m_nSpanNum == 0)
+        {
+            return nullptr;
+        }
+
+        // 暂存区的span已标记为在用，只需设置切分大小；先设切分大小再清除暂存标记，报告看到非暂存时切分大小已有效
+        PageNode* pstPageNode = static_cast<PageNode*>(stStash.m_arrSpan[--stStash.m_nSpanNum]);
+        pstPageNode->nObjectSize.store(nObjectSize, std::memory_order_relaxed);
+        pstPageNode->bStash.store(false, std::memory_order_release);
+        return pstPageNode->pPageAddr;
+    }
+
+    // 把页暂存区中的span全部归还页缓存
+    void MahjongPageCache::ReleaseStash(MahjongPageStash& stStash)
+    {
+        for (size_t i = 0; i < stStash.m_nSpanNum; ++i)
+        {
+            DeleteCacheByPageNum(static_cast<PageNode*>(stStash.m_arrSpan[i])->pPageAddr, stStash.m_nPageNum);
+        }
+        stStash.m_nSpanNum = 0;
+    }
+
     // 通过系统调用分配内存页
-    void* MahjongPageCache::NewCacheBySystem(size_t nPageNum)
+    void* MahjongPageCache::NewCacheBySystem(size_t nShard, size_t nPageNum)
     {
         size_t nSize = nPageNum * PAGESIZE;  // 计算总字节数
+
+        // 多个分片并发申请，先预占字节数再映射；超过硬上限直接失败，由上层清空缓存后重试
+        size_t nSystemCacheSize = m_nSystemCacheSize.load(std::memory_order_relaxed);
+        do
+        {
+            if (m_pstConfig != nullptr && m_pstConfig->m_nHardLimit != 0 && nSystemCacheSize + nSize > m_pstConfig->m_nHardLimit)
+            {
+                return nullptr;
+            }
+        } while (!m_nSystemCacheSize.compare_exchange_weak(nSystemCacheSize, nSystemCacheSize + nSize, std::memory_order_relaxed));
+
+        // 从软上限以下越过软上限时标记内存压力，由线程缓存在不持有锁时处理
+        // 清空缓存后仍在软上限之上时不再重复标记，避免每次申请都清空缓存
+        if (m_pstConfig != nullptr && m_pstConfig->m_nSoftLimit != 0
+            && nSystemCacheSize <= m_pstConfig->m_nSoftLimit && nSystemCacheSize + nSize > m_pstConfig->m_nSoftLimit)
+        {
+            m_bMemoryPressure.store(true, std::memory_order_relaxed);
+        }
+
+        // 持久化模式从段内未使用的页中切出
+        if (m_pstSegment)
+        {
+            void* pstPages = m_pstSegment->NewPages(nPageNum);
+            if (pstPages == nullptr)
+            {
+                m_nSystemCacheSize.fetch_sub(nSize, std::memory_order_relaxed);
+                return nullptr;
+            }
+            memset(pstPages, 0, nSize);
+            return pstPages;
+        }
+
         // 使用mmap申请内存（注意参数）:
         // - 匿名私有映射，无文件关联
         // - 可读写权限
@@ -138,9 +811,19 @@ namespace MahjongMemoryPool
             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
         if (pstNewCache == MAP_FAILED)
         {
+            m_nSystemCacheSize.fetch_sub(nSize, std::memory_order_relaxed);
             return nullptr;  // 系统分配失败
         }
         memset(pstNewCache, 0, nSize);  // 清空内存
+
+        // 地址已有记录说明区域记录与实际映射不一致，放弃这次映射，不能覆盖其他分片的记录
+        std::lock_guard<std::shared_timed_mutex> lock(m_SystemCacheLock);
+        if (!m_SystemCache.emplace(pstNewCache, SystemCache{ nSize, nShard }).second)
+        {
+            munmap(pstNewCache, nSize);
+            m_nSystemCacheSize.fetch_sub(nSize, std::memory_order_relaxed);
+            return nullptr;
+        }
         return pstNewCache;
     }
 }
\ No newline at end of file
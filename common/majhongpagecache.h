@@ -7,43 +7,160 @@
 
 #pragma once
 #include <map>
+#include <memory>
 #include <mutex>
+#include <shared_mutex>
+#include <vector>
 #include "common.h"
+#include "majhongheapreport.h"
+#include "majhongpersistentsegment.h"
 namespace MahjongMemoryPool 
 {
+    // 线程私有的页暂存区：一次从页缓存取出若干个相同页数的span，之后中心缓存的补充直接命中，不加页缓存的锁
+    struct MahjongPageStash
+    {
+        size_t m_nPageNum = 0;   // 暂存span的页数
+        size_t m_nSpanNum = 0;   // 暂存的span个数
+        std::array<void*, MAXPAGESTASHNUM> m_arrSpan;  // 页缓存内部的span节点
+    };
+
+    // 页缓存按分片管理span：每个分片有独立的锁和空闲链表，线程优先在自己的分片中分配
+    // 分片只合并自己向系统申请的页，释放时按地址找到所属分片
 	class MahjongPageCache
 	{
     public:
         static const size_t PAGESIZE = 4096; // 4K页大小
-		static MahjongPageCache& GetInstance() 
-		{
-			static MahjongPageCache stPageCacheInstance;
-			return stPageCacheInstance;
-		}
-        // 从系统中分配指定页数的内存
-		void* NewCacheByPageNum(size_t nPageNum);
+        // pstConfig为空时只有一个分片，且不限制向系统申请的内存
+		explicit MahjongPageCache(const MahjongHeapConfig* pstConfig = nullptr);
+        ~MahjongPageCache();
+        MahjongPageCache(const MahjongPageCache&) = delete;
+        MahjongPageCache& operator=(const MahjongPageCache&) = delete;
+
+        // 计算容纳指定字节数需要的页数（向上取整）
+        static size_t GetPageNumBySize(size_t nSize)
+        {
+            return (nSize + PAGESIZE - 1) / PAGESIZE;
+        }
+        // 从系统中分配指定页数的内存，nRequestSize为大对象实际申请的字节数（用于统计取整浪费）
+        // nObjectSize为span切分的内存块大小（0表示整块使用的大对象span）
+		void* NewCacheByPageNum(size_t nPageNum, size_t nRequestSize = 0, size_t nObjectSize = 0);
         // 释放指定页数的内存
 		void DeleteCacheByPageNum(void* ptr, size_t nPageNum);
-	private:
-		MahjongPageCache() = default;
-
-        // 通过系统调用分配内存页
-		void* NewCacheBySystem(size_t nPageNum);
-	
+        // 从线程页暂存区分配nPageNum页、切分为nObjectSize的span，暂存区为空时从本线程的分片一次补充nStashNum个
+        void* NewCacheByStash(MahjongPageStash& stStash, size_t nPageNum, size_t nStashNum, size_t nObjectSize);
+        // 把页暂存区中的span全部归还页缓存
+        void ReleaseStash(MahjongPageStash& stStash);
+        // 一次性向系统申请指定页数并预先缺页，整块放入空闲链表供后续切分
+        bool ReserveCacheByPageNum(size_t nPageNum);
+        // 原地调整span页数：缩小时把尾部页归还空闲链表，扩大时尝试并入相邻空闲span
+        bool ResizeCacheByPageNum(void* ptr, size_t nNewPageNum, size_t nRequestSize = 0);
+        // 查询指针所在内存块的实际可用字节数，未知指针返回0
+        size_t GetUsableSize(void* ptr);
+        // 查询指针所在的已分配span，返回span起始地址和页数
+        bool GetSpanByAddr(void* ptr, void*& pstSpanAddr, size_t& nPageNum);
+        // 把所有空闲span归还系统，返回归还的字节数
+        size_t ReleaseFreeCache();
+        // 按地址顺序导出所有span（含空闲span）的快照
+        std::vector<MahjongSpanInfo> GetSpanInfo();
+        // 把向系统申请的内存全部归还系统，所有span失效
+        void ReleaseAllCache();
+        // 改为从固定地址的持久化段中切分页，段已存在时恢复其中的全部span
+        // 必须在分配任何内存之前调用
+        bool AttachPersistentSegment(const std::string& strName, uintptr_t nBaseAddr, size_t nSize);
+        MahjongPersistentSegment* GetPersistentSegment() { return m_pstSegment.get(); }
+        // 当前向系统申请的总字节数
+        size_t GetSystemCacheSize() const
+        {
+            return m_nSystemCacheSize.load(std::memory_order_relaxed);
+        }
+        // 向系统申请的内存超过软上限后置位，由堆取得处理权后再清除
+        bool HasMemoryPressure() const
+        {
+            return m_bMemoryPressure.load(std::memory_order_relaxed);
+        }
+        // 返回并清除内存压力标记
+        bool ClearMemoryPressure()
+        {
+            return m_bMemoryPressure.load(std::memory_order_relaxed)
+                && m_bMemoryPressure.exchange(false, std::memory_order_relaxed);
+        }
+        // 分片数
+        size_t GetShardNum() const { return m_vecShard.size(); }
+        // 分片锁竞争统计：等待分片锁的次数和总时长（纳秒），借用其他分片时因其正忙而跳过的次数
+        size_t GetLockWaitNum() const { return m_nLockWaitNum.load(std::memory_order_relaxed); }
+        size_t GetLockWaitTime() const { return m_nLockWaitTime.load(std::memory_order_relaxed); }
+        size_t GetTryLockFailNum() const { return m_nTryLockFailNum.load(std::memory_order_relaxed); }
 	private:
 		struct PageNode
 		{
 			void* pPageAddr;
 			size_t nPageNum;
 			PageNode* pNext;
+            bool bInUse;          // 是否已分配出去
+            std::atomic<size_t> nObjectSize;   // span切分的内存块大小，0表示整块使用；暂存区的span不加锁设置
+            size_t nRequestSize;  // 大对象申请的字节数，0表示未知
+            std::atomic<bool> bStash;          // 在线程页暂存区中，尚未交给中心缓存切分；取出时不加锁清除
 		};
 
-        // 按页数管理空闲span，不同页数对应不同PageNode链表
-		std::map<size_t, PageNode*> m_FreePageNode;
-        
-		// 页号到PageNode的映射，工作中的node节点   用于回收
-		std::map<void*, PageNode*> m_WorkPageNode;
-		std::mutex m_MutexLock;
+        // 页缓存分片
+        struct PageShard
+        {
+            // 按页数管理空闲span，不同页数对应不同PageNode链表
+            std::map<size_t, PageNode*> m_FreePageNode;
+            // 起始地址到PageNode的映射，记录所有span（含空闲span）  用于回收合并与指针反查
+            std::map<void*, PageNode*> m_WorkPageNode;
+            std::mutex m_MutexLock;
+        };
+
+        // 向系统申请的内存区域
+        struct SystemCache
+        {
+            size_t m_nSize;
+            size_t m_nShard;   // 所属分片
+        };
+
+        // 当前线程优先使用的分片
+        size_t GetLocalShard() const;
+        // 加分片锁并统计竞争
+        std::unique_lock<std::mutex> LockShard(PageShard& stShard);
+        // 查找地址所属的分片，未知地址返回nullptr
+        PageShard* GetShardByAddr(void* ptr);
+        // 在分片中分配span（调用方持有分片的锁），bSystem为false时只从空闲链表分配
+        void* NewCacheByShard(size_t nShard, size_t nPageNum, size_t nRequestSize, size_t nObjectSize, bool bSystem);
+        // 把分片的空闲span归还系统，返回归还的字节数
+        size_t ReleaseFreeCacheByShard(PageShard& stShard);
+        // 通过系统调用为分片分配内存页
+		void* NewCacheBySystem(size_t nShard, size_t nPageNum);
+
+        // 查找包含指定地址的span节点
+        PageNode* FindPageNodeByAddr(PageShard& stShard, void* ptr);
+        // 空闲链表插入/摘除节点
+        void InsertFreePageNode(PageShard& stShard, PageNode* pstPageNode);
+        void RemoveFreePageNode(PageShard& stShard, PageNode* pstPageNode);
+        // 从空闲span头部切出指定页数，剩余部分作为新空闲span
+        void SplitPageNode(PageShard& stShard, PageNode* pstPageNode, size_t nPageNum);
+        // 持久化模式下把span信息写穿到段内span表
+        void SyncPageNode(PageNode* pstPageNode);
+        void ClearPageNode(PageNode* pstPageNode);
+        // 从系统内存区域记录中扣除已归还系统的地址范围
+        void RemoveSystemCache(void* ptr, size_t nSize);
+
+        std::vector<std::unique_ptr<PageShard>> m_vecShard;
+
+        // 向系统申请的内存区域（起始地址 -> 字节数和所属分片），用于按地址查找分片，整体释放时逐个munmap
+        // 读多写少，查找加共享锁；持有分片锁时才能加写锁
+        std::map<void*, SystemCache> m_SystemCache;
+        std::shared_timed_mutex m_SystemCacheLock;
+        std::atomic<size_t> m_nSystemCacheSize{ 0 };
+        // 所属堆的配置（软/硬上限）
+        const MahjongHeapConfig* m_pstConfig;
+        std::atomic<bool> m_bMemoryPressure{ false };
+        // 分片锁竞争统计
+        std::atomic<size_t> m_nLockWaitNum{ 0 };
+        std::atomic<size_t> m_nLockWaitTime{ 0 };
+        std::atomic<size_t> m_nTryLockFailNum{ 0 };
+        // 持久化段，为空时直接向系统mmap匿名内存
+        std::unique_ptr<MahjongPersistentSegment> m_pstSegment;
 	};
 
 }
\ No newline at end of file
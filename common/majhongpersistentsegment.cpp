@@ -0,0 +1,267 @@
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "majhongpersistentsegment.h"
+#include "majhongpagecache.h"
+
+namespace MahjongMemoryPool
+{
+    static const uint64_t SEGMENTMAGIC = 0x4D4A48454150ULL;  // "MJHEAP"
+    static const uint64_t SEGMENTVERSION = 2;
+
+    MahjongPersistentSegment::~MahjongPersistentSegment()
+    {
+        Close();
+    }
+
+    // 创建或挂载命名段
+    bool MahjongPersistentSegment::Open(const std::string& strName, uintptr_t nBaseAddr, size_t nSize)
+    {
+        const size_t PAGESIZE = MahjongPageCache::PAGESIZE;
+        if (IsOpen() || nBaseAddr % PAGESIZE != 0 || nSize % PAGESIZE != 0 || nSize < 4 * PAGESIZE)
+        {
+            return false;
+        }
+
+        int nFd = shm_open(strName.c_str(), O_RDWR | O_CREAT, 0600);
+        if (nFd < 0)
+        {
+            return false;
+        }
+
+        // 同一时刻只允许一个进程挂载：滚动重启时旧进程未退出，新进程不能同时修改段头和span表
+        if (flock(nFd, LOCK_EX | LOCK_NB) != 0)
+        {
+            close(nFd);
+            return false;
+        }
+
+        // 已存在的段大小必须一致，新段按需扩展（共享内存按页懒分配，初始全0）
+        struct stat stStat;
+        if (fstat(nFd, &stStat) != 0)
+        {
+            close(nFd);
+            return false;
+        }
+        bool bExist = stStat.st_size != 0;
+        if ((bExist && size_t(stStat.st_size) != nSize) || (!bExist && ftruncate(nFd, nSize) != 0))
+        {
+            close(nFd);
+            return false;
+        }
+
+        // 必须映射到固定地址，段内指针才能在重启后继续使用
+        int nFlag = MAP_SHARED;
+#ifdef MAP_FIXED_NOREPLACE
+        nFlag |= MAP_FIXED_NOREPLACE;
+#endif
+        void* pstBase = mmap(reinterpret_cast<void*>(nBaseAddr), nSize, PROT_READ | PROT_WRITE, nFlag, nFd, 0);
+        if (pstBase == MAP_FAILED || pstBase != reinterpret_cast<void*>(nBaseAddr))
+        {
+            if (pstBase != MAP_FAILED)
+            {
+                munmap(pstBase, nSize);
+            }
+            close(nFd);
+            return false;
+        }
+
+        m_pstHeader = static_cast<SegmentHeader*>(pstBase);
+        m_nFd = nFd;
+        m_bRecovered = bExist
+            && m_pstHeader->m_nMagic == SEGMENTMAGIC
+            && m_pstHeader->m_nVersion == SEGMENTVERSION
+            && m_pstHeader->m_nBaseAddr == nBaseAddr
+            && m_pstHeader->m_nSize == nSize;
+
+        if (!m_bRecovered)
+        {
+            // 新段：段头占一页，随后是每页一项的span表
+            size_t nTotalPageNum = nSize / PAGESIZE;
+            size_t nTablePageNum = (nTotalPageNum * sizeof(SpanEntry) + PAGESIZE - 1) / PAGESIZE;
+            memset(m_pstHeader, 0, sizeof(SegmentHeader));
+            memset(GetSpanTable(), 0, nTablePageNum * PAGESIZE);
+            m_pstHeader->m_nVersion = SEGMENTVERSION;
+            m_pstHeader->m_nBaseAddr = nBaseAddr;
+            m_pstHeader->m_nSize = nSize;
+            m_pstHeader->m_nDataPage = 1 + nTablePageNum;
+            m_pstHeader->m_nTopPage = m_pstHeader->m_nDataPage;
+            // 最后写魔数，初始化中途退出的段下次会重新初始化
+            m_pstHeader->m_nMagic = SEGMENTMAGIC;
+        }
+        return true;
+    }
+
+    // 断开映射，段内数据保留
+    void MahjongPersistentSegment::Close()
+    {
+        if (m_pstHeader != nullptr)
+        {
+            munmap(m_pstHeader, m_pstHeader->m_nSize);
+            m_pstHeader = nullptr;
+        }
+        if (m_nFd >= 0)
+        {
+            flock(m_nFd, LOCK_UN);
+            close(m_nFd);
+            m_nFd = -1;
+        }
+        m_bRecovered = false;
+    }
+
+    // 删除命名段
+    bool MahjongPersistentSegment::Remove(const std::string& strName)
+    {
+        return shm_unlink(strName.c_str()) == 0;
+    }
+
+    // 从未使用的数据页中切出nPageNum页
+    void* MahjongPersistentSegment::NewPages(size_t nPageNum)
+    {
+        if (m_pstHeader->m_nTopPage + nPageNum > m_pstHeader->m_nSize / MahjongPageCache::PAGESIZE)
+        {
+            return nullptr;
+        }
+
+        char* pstPages = reinterpret_cast<char*>(m_pstHeader) + m_pstHeader->m_nTopPage * MahjongPageCache::PAGESIZE;
+        m_pstHeader->m_nTopPage += nPageNum;
+        return pstPages;
+    }
+
+    // 把顶部的页退还为未使用状态
+    bool MahjongPersistentSegment::DeletePages(void* ptr, size_t nPageNum)
+    {
+        if (static_cast<char*>(ptr) + nPageNum * MahjongPageCache::PAGESIZE != GetDataTop())
+        {
+            return false;
+        }
+
+        madvise(ptr, nPageNum * MahjongPageCache::PAGESIZE, MADV_REMOVE);
+        m_pstHeader->m_nTopPage -= nPageNum;
+        return true;
+    }
+
+    // 清空所有span和根对象
+    void MahjongPersistentSegment::Reset()
+    {
+        size_t nUsedPageNum = m_pstHeader->m_nTopPage - m_pstHeader->m_nDataPage;
+        memset(GetSpanTable() + m_pstHeader->m_nDataPage, 0, nUsedPageNum * sizeof(SpanEntry));
+        memset(m_pstHeader->m_arrRoot, 0, sizeof(m_pstHeader->m_arrRoot));
+        SetFreeListTable(nullptr, 0);
+
+        // 数据页的物理内存一并还给系统
+        madvise(GetDataStart(), nUsedPageNum * MahjongPageCache::PAGESIZE, MADV_REMOVE);
+        m_pstHeader->m_nTopPage = m_pstHeader->m_nDataPage;
+    }
+
+    void MahjongPersistentSegment::SetSpan(void* ptr, size_t nPageNum, size_t nObjectSize, bool bInUse)
+    {
+        SpanEntry& stEntry = GetSpanTable()[GetPageIndex(ptr)];
+        stEntry.m_nPageNum = nPageNum;
+        stEntry.m_nObjectSize = uint32_t(nObjectSize);
+        stEntry.m_bInUse = bInUse ? 1 : 0;
+    }
+
+    void MahjongPersistentSegment::ClearSpan(void* ptr)
+    {
+        memset(&GetSpanTable()[GetPageIndex(ptr)], 0, sizeof(SpanEntry));
+    }
+
+    const MahjongPersistentSegment::SpanEntry& MahjongPersistentSegment::GetSpan(void* ptr) const
+    {
+        return GetSpanTable()[GetPageIndex(ptr)];
+    }
+
+    char* MahjongPersistentSegment::GetDataStart() const
+    {
+        return reinterpret_cast<char*>(m_pstHeader) + m_pstHeader->m_nDataPage * MahjongPageCache::PAGESIZE;
+    }
+
+    char* MahjongPersistentSegment::GetDataTop() const
+    {
+        return reinterpret_cast<char*>(m_pstHeader) + m_pstHeader->m_nTopPage * MahjongPageCache::PAGESIZE;
+    }
+
+    size_t MahjongPersistentSegment::GetUsedSize() const
+    {
+        return (m_pstHeader->m_nTopPage - m_pstHeader->m_nDataPage) * MahjongPageCache::PAGESIZE;
+    }
+
+    // 登记根对象，ptr为nullptr时删除
+    bool MahjongPersistentSegment::SetRoot(const char* pszName, void* ptr)
+    {
+        if (pszName == nullptr || strlen(pszName) >= ROOTNAMESIZE)
+        {
+            return false;
+        }
+
+        RootEntry* pstFree = nullptr;
+        for (RootEntry& stRoot : m_pstHeader->m_arrRoot)
+        {
+            if (strcmp(stRoot.m_szName, pszName) == 0)
+            {
+                pstFree = &stRoot;
+                break;
+            }
+            if (pstFree == nullptr && stRoot.m_szName[0] == '\0')
+            {
+                pstFree = &stRoot;
+            }
+        }
+
+        if (pstFree == nullptr)
+        {
+            return ptr == nullptr;  // 槽位已满
+        }
+
+        if (ptr == nullptr)
+        {
+            memset(pstFree, 0, sizeof(RootEntry));
+            return true;
+        }
+
+        strcpy(pstFree->m_szName, pszName);
+        pstFree->m_ptr = ptr;
+        return true;
+    }
+
+    // 查找根对象
+    void* MahjongPersistentSegment::GetRoot(const char* pszName) const
+    {
+        for (const RootEntry& stRoot : m_pstHeader->m_arrRoot)
+        {
+            if (stRoot.m_szName[0] != '\0' && strcmp(stRoot.m_szName, pszName) == 0)
+            {
+                return stRoot.m_ptr;
+            }
+        }
+        return nullptr;
+    }
+
+    // 记录中心自由链表头表
+    void MahjongPersistentSegment::SetFreeListTable(FreeListEntry* pstTable, size_t nNum)
+    {
+        m_pstHeader->m_pstFreeListTable = pstTable;
+        m_pstHeader->m_nFreeListNum = pstTable != nullptr ? nNum : 0;
+    }
+
+    // 读取中心自由链表头表
+    MahjongPersistentSegment::FreeListEntry* MahjongPersistentSegment::GetFreeListTable(size_t& nNum) const
+    {
+        nNum = m_pstHeader->m_nFreeListNum;
+        return m_pstHeader->m_pstFreeListTable;
+    }
+
+    size_t MahjongPersistentSegment::GetPageIndex(void* ptr) const
+    {
+        return size_t(static_cast<char*>(ptr) - reinterpret_cast<char*>(m_pstHeader)) / MahjongPageCache::PAGESIZE;
+    }
+
+    MahjongPersistentSegment::SpanEntry* MahjongPersistentSegment::GetSpanTable() const
+    {
+        return reinterpret_cast<SpanEntry*>(reinterpret_cast<char*>(m_pstHeader) + MahjongPageCache::PAGESIZE);
+    }
+}
@@ -0,0 +1,112 @@
+/*
+   @Time     : 2018/7/24 11:20
+   @Author   : 王一冰
+   @Describe : 固定地址映射的共享内存段，进程重启后重新挂载即可找回堆
+   @Software : Copyright (c) 2018 中国手游娱乐集团有限公司
+*/
+#pragma once
+#include <cstdint>
+#include <string>
+#include "common.h"
+
+namespace MahjongMemoryPool
+{
+    // 持久化段：/dev/shm下的命名共享内存，映射到固定地址
+    // 段内布局：段头 | span表（每页一项） | 数据页
+    // 页缓存的span信息写穿到span表，重新挂载时据此重建，段内对象的指针在重启后依然有效
+    class MahjongPersistentSegment
+    {
+    public:
+        static const size_t ROOTNUM = 32;       // 根对象槽位数
+        static const size_t ROOTNAMESIZE = 32;  // 根对象名字最大长度（含结尾0）
+
+        // span表项，只在span起始页上有效
+        struct SpanEntry
+        {
+            uint64_t m_nPageNum;     // span页数，0表示不是span起始页
+            uint32_t m_nObjectSize;  // span切分的内存块大小，0表示整块使用
+            uint32_t m_bInUse;       // 是否已分配出去
+        };
+
+        // 中心自由链表头表项：正常退出时记录各尺寸类的链表头，链表的指针就存在段内的空闲块中
+        struct FreeListEntry
+        {
+            uint64_t m_nIndex;   // 尺寸类下标
+            void* m_pstHead;     // 自由链表头
+        };
+
+        MahjongPersistentSegment() = default;
+        ~MahjongPersistentSegment();
+        MahjongPersistentSegment(const MahjongPersistentSegment&) = delete;
+        MahjongPersistentSegment& operator=(const MahjongPersistentSegment&) = delete;
+
+        // 创建或挂载命名段，映射到nBaseAddr；段已存在且布局一致时为恢复模式
+        // 挂载期间持有段的排他文件锁，段已被其他进程（或本进程的另一个实例）挂载时返回false
+        bool Open(const std::string& strName, uintptr_t nBaseAddr, size_t nSize);
+        // 断开映射，段内数据保留
+        void Close();
+        // 删除命名段
+        static bool Remove(const std::string& strName);
+
+        bool IsOpen() const { return m_pstHeader != nullptr; }
+        // 是否挂载到已有的段
+        bool IsRecovered() const { return m_bRecovered; }
+
+        // 从未使用的数据页中切出nPageNum页，段空间不足返回nullptr
+        void* NewPages(size_t nPageNum);
+        // 把顶部的nPageNum页退还为未使用状态，ptr不在顶部时返回false
+        bool DeletePages(void* ptr, size_t nPageNum);
+        // 清空所有span和根对象，数据页全部回到未使用状态
+        void Reset();
+
+        // 写入/清除span表项
+        void SetSpan(void* ptr, size_t nPageNum, size_t nObjectSize, bool bInUse);
+        void ClearSpan(void* ptr);
+        // 读取span表项
+        const SpanEntry& GetSpan(void* ptr) const;
+
+        // 数据页起始地址和已使用部分的结尾
+        char* GetDataStart() const;
+        char* GetDataTop() const;
+        // 已从段中切出的字节数
+        size_t GetUsedSize() const;
+
+        // 登记/查找根对象，重启后通过名字找回
+        bool SetRoot(const char* pszName, void* ptr);
+        void* GetRoot(const char* pszName) const;
+
+        // 记录/读取中心自由链表头表，表本身放在段内的一个span中，pstTable为nullptr时清除
+        void SetFreeListTable(FreeListEntry* pstTable, size_t nNum);
+        FreeListEntry* GetFreeListTable(size_t& nNum) const;
+
+    private:
+        struct RootEntry
+        {
+            char m_szName[ROOTNAMESIZE];
+            void* m_ptr;
+        };
+
+        // 段头，位于段的第一页
+        struct SegmentHeader
+        {
+            uint64_t m_nMagic;
+            uint64_t m_nVersion;
+            uint64_t m_nBaseAddr;
+            uint64_t m_nSize;
+            uint64_t m_nDataPage;   // 数据区起始页号
+            uint64_t m_nTopPage;    // 已切出页的上界页号
+            RootEntry m_arrRoot[ROOTNUM];
+            FreeListEntry* m_pstFreeListTable;  // 中心自由链表头表，nullptr表示没有
+            uint64_t m_nFreeListNum;
+        };
+
+        // 段内地址对应的页号
+        size_t GetPageIndex(void* ptr) const;
+        SpanEntry* GetSpanTable() const;
+
+    private:
+        SegmentHeader* m_pstHeader = nullptr;
+        int m_nFd = -1;
+        bool m_bRecovered = false;
+    };
+}